@@ -10,7 +10,8 @@
 #include <unistd.h>
 #include <time.h>
 
-#include "common.h"
+#include "cd_utils.h"
+#include "cd_list.h"
 #include "arch_wrapper.h"
 
 
@@ -36,3 +37,53 @@ void _dputs(char *str)
 {
     fputs(str, stdout);
 }
+
+// output is not buffered
+void debug_flush(void)
+{
+}
+
+
+#ifdef ARCH_SPI
+
+int spi_mem_write(spi_t *spi, uint8_t mem_addr, const uint8_t *buf, int len)
+{
+    gpio_set_value(spi->ns_pin, 0);
+    spi->xfer(spi, &mem_addr, NULL, 1);
+    spi->xfer(spi, buf, NULL, len);
+    gpio_set_value(spi->ns_pin, 1);
+    return 0;
+}
+
+int spi_mem_read(spi_t *spi, uint8_t mem_addr, uint8_t *buf, int len)
+{
+    gpio_set_value(spi->ns_pin, 0);
+    spi->xfer(spi, &mem_addr, NULL, 1);
+    spi->xfer(spi, NULL, buf, len);
+    gpio_set_value(spi->ns_pin, 1);
+    return 0;
+}
+
+int spi_dma_write(spi_t *spi, const uint8_t *buf, int len)
+{
+    spi->xfer(spi, buf, NULL, len);
+    spi->dma_done = true;
+    return 0;
+}
+
+int spi_dma_read(spi_t *spi, uint8_t *buf, int len)
+{
+    spi->xfer(spi, NULL, buf, len);
+    spi->dma_done = true;
+    return 0;
+}
+
+int spi_dma_write_read(spi_t *spi, const uint8_t *wr_buf,
+        uint8_t *rd_buf, int len)
+{
+    spi->xfer(spi, wr_buf, rd_buf, len);
+    spi->dma_done = true;
+    return 0;
+}
+
+#endif
@@ -26,4 +26,49 @@ uint32_t get_systick(void);
 #define SYSTICK_US_DIV  1000
 #endif
 
+
+// gpio wrapper, set_hook is for simulated devices, e.g. cdctl_model
+
+typedef struct gpio {
+    bool        value;
+    void        (* set_hook)(struct gpio *gpio, bool value);
+    void        *dev;
+} gpio_t;
+
+static inline bool gpio_get_value(gpio_t *gpio)
+{
+    return gpio->value;
+}
+
+static inline void gpio_set_value(gpio_t *gpio, bool value)
+{
+    gpio->value = value;
+    if (gpio->set_hook)
+        gpio->set_hook(gpio, value);
+}
+
+
+// define ARCH_SPI in cd_config.h to use the spi controller drivers,
+// e.g. cdctl_bx with cdctl_model, see arch/pc/cdctl_sim/cd_config.h
+#ifdef ARCH_SPI
+// spi wrapper, the bytes are exchanged with a simulated device by xfer,
+// dma transfers finish at once and set dma_done,
+// the caller clears it and calls the dma finish isr
+
+typedef struct spi {
+    gpio_t      *ns_pin;
+    void        (* xfer)(struct spi *spi, const uint8_t *wr_buf,
+                        uint8_t *rd_buf, int len);
+    void        *dev;
+    bool        dma_done;
+} spi_t;
+
+int spi_mem_write(spi_t *spi, uint8_t mem_addr, const uint8_t *buf, int len);
+int spi_mem_read(spi_t *spi, uint8_t mem_addr, uint8_t *buf, int len);
+int spi_dma_write(spi_t *spi, const uint8_t *buf, int len);
+int spi_dma_read(spi_t *spi, uint8_t *buf, int len);
+int spi_dma_write_read(spi_t *spi, const uint8_t *wr_buf,
+        uint8_t *rd_buf, int len);
+#endif
+
 #endif
@@ -0,0 +1,289 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#include "cdctl_model.h"
+#include "cdctl_bx_regs.h"
+
+
+static void cdctl_model_reset(cdctl_model_t *m)
+{
+    memset(m->regs, 0, sizeof(m->regs));
+    m->regs[REG_VERSION] = CDCTL_MODEL_VERSION;
+    m->regs[REG_TX_WAIT_LEN] = 1;
+    m->regs[REG_FILTER] = 0xff;
+    m->regs[REG_DIV_LS_L] = 346 & 0xff; // 115200 bps
+    m->regs[REG_DIV_LS_H] = 346 >> 8;
+    m->regs[REG_DIV_HS_L] = 346 & 0xff;
+    m->regs[REG_DIV_HS_H] = 346 >> 8;
+    m->int_mask = 0;
+    m->flags = 0;
+    m->rx_rd = 0;
+    m->rx_cnt = 0;
+    m->rx_ptr = 0;
+    m->tx_fill = 0;
+    m->tx_ptr = 0;
+    m->tx_act = false;
+}
+
+static uint8_t cdctl_model_flags(cdctl_model_t *m)
+{
+    uint8_t flags = m->flags;
+    if (!m->tx_act)
+        flags |= BIT_FLAG_BUS_IDLE | BIT_FLAG_TX_BUF_CLEAN;
+    if (m->rx_cnt)
+        flags |= BIT_FLAG_RX_PENDING;
+    return flags;
+}
+
+static void cdctl_model_update_int(cdctl_model_t *m)
+{
+    bool val = !(cdctl_model_flags(m) & m->int_mask);
+    if (m->int_n.value && !val)
+        m->int_edge = true;
+    m->int_n.value = val;
+}
+
+// ns per bit for the divider registers at pos
+static uint32_t cdctl_model_bit_time(cdctl_model_t *m, uint8_t pos)
+{
+    uint16_t div = m->regs[pos] | m->regs[pos + 1] << 8;
+    return (div + 1) * 1000000000ULL / CDCTL_SYS_CLK;
+}
+
+static void cdctl_model_tx_start(cdctl_model_t *m)
+{
+    uint8_t *dat = m->tx_page[m->tx_fill];
+    uint32_t ls = cdctl_model_bit_time(m, REG_DIV_LS_L);
+    uint32_t hs = cdctl_model_bit_time(m, REG_DIV_HS_L);
+    // tx_wait idle bytes and the header at low speed for arbitration,
+    // the rest at high speed, 10 bits per byte, 2 bytes crc
+    if (m->regs[REG_SETTING] & BIT_SETTING_NO_ARBITRATE)
+        ls = hs;
+    m->tx_end = m->time + (m->regs[REG_TX_WAIT_LEN] + 1) * 10 * ls +
+            (dat[2] + 4) * 10 * hs;
+    m->tx_fill ^= 1;
+    m->tx_ptr = 0;
+    m->tx_act = true;
+}
+
+static void cdctl_model_tx_done(cdctl_model_t *m)
+{
+    m->tx_act = false;
+    m->tx_frames++;
+    if (m->peer) {
+        cdctl_model_rx(m->peer, m->tx_page[!m->tx_fill]);
+        cdctl_model_update_int(m->peer);
+    }
+    cdctl_model_update_int(m);
+}
+
+static uint8_t cdctl_model_read(cdctl_model_t *m, uint8_t reg)
+{
+    switch (reg) {
+    case REG_VERSION ... REG_DIV_HS_H:
+        return m->regs[reg];
+    case REG_INT_FLAG:
+        return cdctl_model_flags(m);
+    case REG_INT_MASK:
+        return m->int_mask;
+    case REG_RX:
+        if (!m->rx_cnt || m->rx_ptr >= 259)
+            return 0xff;
+        return m->rx_page[m->rx_rd][m->rx_ptr++];
+    case REG_RX_PAGE_FLAG:
+        return (1 << m->rx_cnt) - 1;
+    default:
+        return 0xff;
+    }
+}
+
+static void cdctl_model_write(cdctl_model_t *m, uint8_t reg, uint8_t val)
+{
+    switch (reg) {
+    case REG_SETTING ... REG_DIV_HS_H:
+        m->regs[reg] = val;
+        break;
+    case REG_INT_MASK:
+        m->int_mask = val;
+        break;
+    case REG_TX:
+        if (m->tx_ptr < 259)
+            m->tx_page[m->tx_fill][m->tx_ptr++] = val;
+        break;
+
+    case REG_RX_CTRL:
+        if (val & BIT_RX_RST_POINTER)
+            m->rx_ptr = 0;
+        if ((val & BIT_RX_CLR_PENDING) && m->rx_cnt) {
+            m->rx_rd = (m->rx_rd + 1) % CDCTL_MODEL_RX_PAGES;
+            m->rx_cnt--;
+            m->rx_ptr = 0;
+        }
+        if (val & BIT_RX_CLR_LOST)
+            m->flags &= ~BIT_FLAG_RX_LOST;
+        if (val & BIT_RX_CLR_ERROR)
+            m->flags &= ~BIT_FLAG_RX_ERROR;
+        if (val & BIT_RX_RST) {
+            m->rx_cnt = 0;
+            m->rx_ptr = 0;
+        }
+        break;
+
+    case REG_TX_CTRL:
+        if (val & BIT_TX_CLR_CD)
+            m->flags &= ~BIT_FLAG_TX_CD;
+        if (val & BIT_TX_CLR_ERROR)
+            m->flags &= ~BIT_FLAG_TX_ERROR;
+        if (val & BIT_TX_ABORT)
+            m->tx_act = false;
+        if (val & BIT_TX_RST_POINTER)
+            m->tx_ptr = 0;
+        // ignored if the active page is not clean
+        if ((val & BIT_TX_START) && !m->tx_act && m->tx_ptr)
+            cdctl_model_tx_start(m);
+        break;
+    }
+}
+
+static void cdctl_model_xfer(spi_t *spi, const uint8_t *wr_buf,
+        uint8_t *rd_buf, int len)
+{
+    cdctl_model_t *m = spi->dev;
+
+    for (int i = 0; i < len; i++) {
+        uint8_t wr = wr_buf ? wr_buf[i] : 0xff;
+        uint8_t rd = 0xff;
+        m->spi_bytes++;
+        m->time += m->spi_byte_time;
+
+        if (!m->cs) {
+            // not selected
+        } else if (m->addr < 0) {
+            m->addr = wr;
+        } else if (m->addr & 0x80) {
+            cdctl_model_write(m, m->addr & 0x7f, wr);
+        } else {
+            rd = cdctl_model_read(m, m->addr);
+        }
+        if (rd_buf)
+            rd_buf[i] = rd;
+    }
+    cdctl_model_update_int(m);
+}
+
+static void cdctl_model_cs_hook(gpio_t *gpio, bool value)
+{
+    cdctl_model_t *m = gpio->dev;
+    if (!value && !m->cs) {
+        m->spi_xfers++;
+        m->addr = -1;
+    }
+    m->cs = !value;
+}
+
+static void cdctl_model_rst_hook(gpio_t *gpio, bool value)
+{
+    cdctl_model_t *m = gpio->dev;
+    if (!value) {
+        cdctl_model_reset(m);
+        cdctl_model_update_int(m);
+    }
+}
+
+
+void cdctl_model_init(cdctl_model_t *m)
+{
+    if (!m->name)
+        m->name = "cdctl_model";
+    if (!m->spi_byte_time)
+        m->spi_byte_time = 400; // 20 MHz sclk
+    if (!m->isr_time)
+        m->isr_time = 1000;
+
+    m->ns_pin.value = 1;
+    m->ns_pin.set_hook = cdctl_model_cs_hook;
+    m->ns_pin.dev = m;
+    m->rst_n.value = 1;
+    m->rst_n.set_hook = cdctl_model_rst_hook;
+    m->rst_n.dev = m;
+    m->int_n.value = 1;
+    m->int_n.set_hook = NULL;
+    m->int_n.dev = m;
+
+    m->spi.ns_pin = &m->ns_pin;
+    m->spi.xfer = cdctl_model_xfer;
+    m->spi.dev = m;
+    m->spi.dma_done = false;
+
+    m->cs = false;
+    m->addr = -1;
+    m->int_edge = false;
+    cdctl_model_reset(m);
+}
+
+// frame from the bus, dat: [src, dst, len, ...]
+void cdctl_model_rx(cdctl_model_t *m, const uint8_t *dat)
+{
+    uint8_t filter = m->regs[REG_FILTER];
+    if (filter != 0xff && dat[1] != 0xff && dat[1] != filter)
+        return;
+
+    if (m->rx_cnt == CDCTL_MODEL_RX_PAGES) {
+        m->flags |= BIT_FLAG_RX_LOST;
+        m->rx_lost++;
+    } else {
+        uint8_t n = (m->rx_rd + m->rx_cnt) % CDCTL_MODEL_RX_PAGES;
+        memcpy(m->rx_page[n], dat, dat[2] + 3);
+        m->rx_cnt++;
+        m->rx_frames++;
+    }
+    cdctl_model_update_int(m);
+}
+
+// handle one event: end of tx, dma finish isr, int_n isr,
+// or skip the idle time until the end of tx,
+// return false if there is nothing to do
+bool cdctl_model_run(cdctl_model_t *m)
+{
+    if (m->tx_act && m->time >= m->tx_end)
+        cdctl_model_tx_done(m);
+
+    if (m->spi.dma_done && m->spi_isr) {
+        m->spi.dma_done = false;
+        m->spi_isr_cnt++;
+        m->time += m->isr_time;
+        m->spi_isr(m->isr_arg);
+        return true;
+    }
+    if (m->int_edge && m->int_isr) {
+        m->int_edge = false;
+        m->int_isr_cnt++;
+        m->time += m->isr_time;
+        m->int_isr(m->isr_arg);
+        return true;
+    }
+    if (m->tx_act) {
+        m->time = m->tx_end;
+        return true;
+    }
+    return false;
+}
+
+void cdctl_model_show(cdctl_model_t *m)
+{
+    uint32_t frames = max(1U, m->tx_frames + m->rx_frames);
+    printf("%s: time %llu us, tx %u, rx %u, rx lost %u\n", m->name,
+            (unsigned long long)m->time / 1000,
+            m->tx_frames, m->rx_frames, m->rx_lost);
+    printf("  spi: %u bytes, %u xfers, isr: spi %u, int %u\n",
+            m->spi_bytes, m->spi_xfers, m->spi_isr_cnt, m->int_isr_cnt);
+    printf("  per frame: %u bytes, %u xfers, %u isr\n",
+            m->spi_bytes / frames, m->spi_xfers / frames,
+            (m->spi_isr_cnt + m->int_isr_cnt) / frames);
+}
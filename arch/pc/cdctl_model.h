@@ -0,0 +1,80 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#ifndef __CDCTL_MODEL_H__
+#define __CDCTL_MODEL_H__
+
+#include "cd_utils.h"
+#include "arch_wrapper.h"
+
+// register level model of CDCTL-Bx for running the drivers on pc,
+// connect the driver to model.spi, model.rst_n and model.int_n
+
+#ifndef CDCTL_MODEL_VERSION
+#define CDCTL_MODEL_VERSION     0x0e
+#endif
+#ifndef CDCTL_MODEL_RX_PAGES
+#define CDCTL_MODEL_RX_PAGES    4
+#endif
+
+typedef struct cdctl_model {
+    const char  *name;
+
+    uint8_t     regs[9];    // REG_VERSION ~ REG_DIV_HS_H
+    uint8_t     int_mask;
+    uint8_t     flags;      // latched: rx_lost, rx_error, tx_cd, tx_error
+
+    uint8_t     rx_page[CDCTL_MODEL_RX_PAGES][259];
+    uint8_t     rx_rd;      // first pending page
+    uint8_t     rx_cnt;     // pending pages
+    uint16_t    rx_ptr;
+
+    uint8_t     tx_page[2][259];
+    uint8_t     tx_fill;    // page for REG_TX write, the other one is active
+    uint16_t    tx_ptr;
+    bool        tx_act;     // active page is on the wire
+    uint64_t    tx_end;
+
+    bool        cs;
+    int16_t     addr;       // -1: next byte is the address
+    bool        int_edge;   // int_n falling edge not handled yet
+
+    spi_t       spi;
+    gpio_t      ns_pin;
+    gpio_t      rst_n;
+    gpio_t      int_n;
+
+    struct cdctl_model *peer; // receiver of our frames, optional
+
+    // e.g. cdctl_spi_isr, cdctl_int_isr of interrupt driver
+    void        (* spi_isr)(void *arg);
+    void        (* int_isr)(void *arg);
+    void        *isr_arg;
+
+    // virtual time in ns, advanced by spi bytes, isr calls and bus idle
+    uint64_t    time;
+    uint32_t    spi_byte_time;
+    uint32_t    isr_time;
+
+    uint32_t    spi_bytes;
+    uint32_t    spi_xfers;  // chip select cycles
+    uint32_t    spi_isr_cnt;
+    uint32_t    int_isr_cnt;
+    uint32_t    tx_frames;
+    uint32_t    rx_frames;
+    uint32_t    rx_lost;
+} cdctl_model_t;
+
+
+void cdctl_model_init(cdctl_model_t *m);
+void cdctl_model_rx(cdctl_model_t *m, const uint8_t *dat);
+bool cdctl_model_run(cdctl_model_t *m);
+void cdctl_model_show(cdctl_model_t *m);
+
+#endif
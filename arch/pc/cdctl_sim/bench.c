@@ -0,0 +1,106 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+/*
+ * tx throughput from a to b, the time is the virtual time of the model
+ *
+ * build at the top of the repo:
+ *   gcc -Iarch/pc/cdctl_sim -Iarch/pc -Iutils -Inet -Idev \
+ *       arch/pc/cdctl_sim/bench.c arch/pc/cdctl_sim/sim.c \
+ *       arch/pc/cdctl_model.c arch/pc/arch_wrapper.c dev/cdctl_bx_it.c \
+ *       utils/cd_list.c utils/cd_ring.c utils/cd_mag.c utils/hex_dump.c \
+ *       -o cdctl_bench
+ * usage: cdctl_bench [frames] [baud_l] [baud_h] [duplex] [p2p]
+ *   duplex: b also sends to a, the bus sharing is not modeled, only for
+ *           the driver cost of tx with rx
+ *   p2p: CD_MODE_P2P instead of CD_MODE_BUS, the whole frame at baud_h
+ */
+
+#include "sim.h"
+
+static const uint8_t bench_len[] = { 10, 64, 250 };
+static uint32_t baud_l = 115200;
+static uint32_t baud_h = 10000000;
+static bool duplex = false;
+static cd_mode_t mode = CD_MODE_BUS;
+
+
+// keep the tx queue full, half of the frames are left for rx
+static void bench_tx(sim_node_t *n, uint8_t src, uint8_t dst,
+        uint8_t len, int *sent, int num)
+{
+    cd_intf_t *intf = &n->intf.cd_intf;
+    cd_frame_t *frame;
+    while (*sent < num && n->free_head.len > SIM_FRAME_NUM / 2 &&
+            (frame = intf->get_free_frame(intf))) {
+        frame->dat[0] = src;
+        frame->dat[1] = dst;
+        frame->dat[2] = len;
+        memset(frame->dat + 3, *sent, len);
+        intf->put_tx_frame(intf, frame);
+        (*sent)++;
+    }
+}
+
+static void bench_rx(cd_intf_t *intf, uint8_t len, int *got)
+{
+    cd_frame_t *frame;
+    while ((frame = intf->get_rx_frame(intf))) {
+        if (frame->dat[2] != len)
+            printf("len %3d: wrong len %d\n", len, frame->dat[2]);
+        intf->put_free_frame(intf, frame);
+        (*got)++;
+    }
+}
+
+static int bench(int num, uint8_t len)
+{
+    int sent = 0, got = 0, b_sent = 0, b_got = 0;
+    uint32_t guard = 0;
+
+    if (sim_init(mode, baud_l, baud_h))
+        return -1;
+
+    while (got < num) {
+        if (++guard > num * 1000U) {
+            printf("len %3d: stalled, sent %d, got %d\n", len, sent, got);
+            return -1;
+        }
+        bench_tx(&sim_a, 0x01, 0x02, len, &sent, num);
+        if (duplex)
+            bench_tx(&sim_b, 0x02, 0x01, len, &b_sent, num);
+        bench_rx(&sim_b.intf.cd_intf, len, &got);
+        bench_rx(&sim_a.intf.cd_intf, len, &b_got);
+        sim_run();
+    }
+
+    printf("len %3d: %6.0f frames/s, per frame: a %u spi bytes, %u isr\n",
+            len, got * 1e9 / sim_time(), sim_a.model.spi_bytes / got,
+            (sim_a.model.spi_isr_cnt + sim_a.model.int_isr_cnt) / got);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int num = argc > 1 ? atoi(argv[1]) : 1000;
+    if (argc > 2)
+        baud_l = atoi(argv[2]);
+    if (argc > 3)
+        baud_h = atoi(argv[3]);
+    duplex = argc > 4 && atoi(argv[4]);
+    if (argc > 5 && atoi(argv[5]))
+        mode = CD_MODE_P2P;
+
+    printf("%d frames, %u / %u bps, %s\n", num, baud_l, baud_h,
+            mode == CD_MODE_P2P ? "p2p" : "bus");
+    for (uint32_t i = 0; i < sizeof(bench_len); i++)
+        if (bench(num, bench_len[i]))
+            return 1;
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#ifndef __CD_CONFIG_H__
+#define __CD_CONFIG_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ARCH_SPI
+#define USE_DYNAMIC_INIT
+#define CD_LIST_IT
+
+#include "arch_wrapper.h"
+#include "cd_debug.h"
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+/*
+ * driver correctness test, a and b send to each other at the same time,
+ * the receivers check the length, the content and the order of each frame,
+ * returns non-zero on any error
+ *
+ * build at the top of the repo:
+ *   gcc -Iarch/pc/cdctl_sim -Iarch/pc -Iutils -Inet -Idev \
+ *       arch/pc/cdctl_sim/loopback.c arch/pc/cdctl_sim/sim.c \
+ *       arch/pc/cdctl_model.c arch/pc/arch_wrapper.c dev/cdctl_bx_it.c \
+ *       utils/cd_list.c utils/cd_ring.c utils/cd_mag.c utils/hex_dump.c \
+ *       -o cdctl_loopback
+ *   for the polled driver: add -DSIM_POLLED and use dev/cdctl_bx.c
+ * usage: cdctl_loopback [frames] [urgent] [p2p]
+ *   urgent: index of the frame of a sent by put_tx_frame_urgent, -1 for none
+ *   p2p: use CD_MODE_P2P instead of CD_MODE_BUS
+ */
+
+#include "sim.h"
+
+typedef struct {
+    sim_node_t  *n;
+    uint8_t     src;
+    uint8_t     dst;
+    int         sent;
+    int         got;    // frames received from the peer
+    int         last;   // last index received, not include the urgent one
+    int         dup;    // sent again after aborted for the urgent one
+    int         err;
+} lb_side_t;
+
+static int lb_num = 200;
+static int lb_urgent = -1;
+
+
+// the length and content are derived from the index
+static inline uint8_t lb_len(int idx)
+{
+    return 2 + idx * 37 % 252;
+}
+
+static void lb_tx(lb_side_t *s)
+{
+    cd_intf_t *intf = &s->n->intf.cd_intf;
+    cd_frame_t *frame;
+    while (s->sent < lb_num && s->n->free_head.len > SIM_FRAME_NUM / 2 &&
+            (frame = intf->get_free_frame(intf))) {
+        uint8_t len = lb_len(s->sent);
+        frame->dat[0] = s->src;
+        frame->dat[1] = s->dst;
+        frame->dat[2] = len;
+        frame->dat[3] = s->sent;
+        frame->dat[4] = s->sent >> 8;
+        for (int i = 5; i < len + 3; i++)
+            frame->dat[i] = s->sent + i;
+
+        if (s->src == 0x01 && s->sent == lb_urgent &&
+                intf->put_tx_frame_urgent)
+            intf->put_tx_frame_urgent(intf, frame);
+        else
+            intf->put_tx_frame(intf, frame);
+        s->sent++;
+    }
+}
+
+static int lb_check(lb_side_t *s, const cd_frame_t *frame)
+{
+    int idx = frame->dat[3] | frame->dat[4] << 8;
+    uint8_t len = lb_len(idx);
+
+    if (frame->dat[0] != s->dst || frame->dat[1] != s->src) {
+        printf("%s: wrong mac %02x -> %02x\n",
+                s->n->intf.name, frame->dat[0], frame->dat[1]);
+        return -1;
+    }
+    if (idx >= lb_num || frame->dat[2] != len) {
+        printf("%s: #%d wrong len %d\n", s->n->intf.name, idx, frame->dat[2]);
+        return -1;
+    }
+    for (int i = 5; i < len + 3; i++) {
+        if (frame->dat[i] != (uint8_t)(idx + i)) {
+            printf("%s: #%d wrong dat at %d\n", s->n->intf.name, idx, i);
+            return -1;
+        }
+    }
+    // the urgent frame jumps the queue, the others keep the order
+    if (s->dst == 0x01 && idx == lb_urgent)
+        return 0;
+    if (idx == s->last) {
+        s->dup++;
+        return 0;
+    }
+    if (idx < s->last) {
+        printf("%s: #%d after #%d\n", s->n->intf.name, idx, s->last);
+        return -1;
+    }
+    s->last = idx;
+    return 0;
+}
+
+static void lb_rx(lb_side_t *s)
+{
+    cd_intf_t *intf = &s->n->intf.cd_intf;
+    cd_frame_t *frame;
+    while ((frame = intf->get_rx_frame(intf))) {
+        if (lb_check(s, frame))
+            s->err++;
+        intf->put_free_frame(intf, frame);
+        s->got++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    cd_mode_t mode = CD_MODE_BUS;
+    lb_side_t a = { .n = &sim_a, .src = 0x01, .dst = 0x02, .last = -1 };
+    lb_side_t b = { .n = &sim_b, .src = 0x02, .dst = 0x01, .last = -1 };
+    uint32_t guard = 0;
+
+    if (argc > 1)
+        lb_num = atoi(argv[1]);
+    if (argc > 2)
+        lb_urgent = atoi(argv[2]);
+    if (argc > 3 && atoi(argv[3]))
+        mode = CD_MODE_P2P;
+    if (lb_num > 0xffff)
+        lb_num = 0xffff;
+
+    if (sim_init(mode, 115200, 10000000))
+        return 1;
+
+    // b->got counts the frames of a, including the duplicates
+    while (b.got - b.dup < lb_num || a.got - a.dup < lb_num) {
+        if (++guard > lb_num * 1000U) {
+            printf("stalled\n");
+            break;
+        }
+        lb_tx(&a);
+        lb_tx(&b);
+        lb_rx(&a);
+        lb_rx(&b);
+        sim_run();
+    }
+    for (int i = 0; i < 100; i++)
+        sim_run(); // release the last tx_act
+
+    printf("a -> b: sent %d, got %d, aborted %u, dup %d, err %d\n", a.sent,
+            b.got, sim_a.intf.tx_abort_cnt, b.dup, b.err);
+    printf("b -> a: sent %d, got %d, aborted %u, dup %d, err %d\n", b.sent,
+            a.got, sim_b.intf.tx_abort_cnt, a.dup, a.err);
+    printf("free a %u, b %u of %d\n", sim_a.free_head.len,
+            sim_b.free_head.len, SIM_FRAME_NUM);
+    cdctl_model_show(&sim_a.model);
+    cdctl_model_show(&sim_b.model);
+
+    if (guard > lb_num * 1000U || a.err || b.err)
+        return 1;
+    // one frame may be kept by the driver as the rx buffer
+    if (sim_a.free_head.len < SIM_FRAME_NUM - 1 ||
+            sim_b.free_head.len < SIM_FRAME_NUM - 1) {
+        printf("frames leaked\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#include "sim.h"
+
+sim_node_t sim_a, sim_b;
+
+#ifndef SIM_POLLED
+static void sim_spi_isr(void *arg)
+{
+    cdctl_spi_isr(arg);
+}
+
+static void sim_int_isr(void *arg)
+{
+    cdctl_int_isr(arg);
+}
+#endif
+
+static int sim_node_init(sim_node_t *n, const char *name, uint8_t mac,
+        cd_mode_t mode, uint32_t baud_l, uint32_t baud_h)
+{
+    memset(n, 0, sizeof(*n));
+    for (int i = 0; i < SIM_FRAME_NUM; i++)
+        list_put(&n->free_head, &n->frames[i].node);
+
+    n->model.name = name;
+    cdctl_model_init(&n->model);
+    n->intf.name = name;
+    n->intf.mode = mode;
+#ifdef SIM_POLLED
+    return cdctl_intf_init(&n->intf, &n->free_head, mac, baud_l, baud_h,
+            &n->model.spi, &n->model.rst_n);
+#else
+    n->model.spi_isr = sim_spi_isr;
+    n->model.int_isr = sim_int_isr;
+    n->model.isr_arg = &n->intf;
+    return cdctl_intf_init(&n->intf, &n->free_head, mac, baud_l, baud_h,
+            &n->model.spi, &n->model.rst_n, &n->model.int_n);
+#endif
+}
+
+static void sim_stat_clear(cdctl_model_t *m)
+{
+    m->time = 0;
+    m->spi_bytes = m->spi_xfers = 0;
+    m->spi_isr_cnt = m->int_isr_cnt = 0;
+    m->tx_frames = m->rx_frames = m->rx_lost = 0;
+}
+
+int sim_init(cd_mode_t mode, uint32_t baud_l, uint32_t baud_h)
+{
+    if (sim_node_init(&sim_a, "a", 0x01, mode, baud_l, baud_h) ||
+            sim_node_init(&sim_b, "b", 0x02, mode, baud_l, baud_h))
+        return -1;
+    sim_a.model.peer = &sim_b.model;
+    sim_b.model.peer = &sim_a.model;
+    // not count the init
+    sim_stat_clear(&sim_a.model);
+    sim_stat_clear(&sim_b.model);
+    return 0;
+}
+
+// one step of both sides, the receiver follows the sender's clock
+void sim_run(void)
+{
+#ifdef SIM_POLLED
+    cdctl_routine(&sim_a.intf);
+    cdctl_routine(&sim_b.intf);
+#endif
+    cdctl_model_run(&sim_a.model);
+    cdctl_model_run(&sim_b.model);
+    if (sim_b.model.time < sim_a.model.time)
+        sim_b.model.time = sim_a.model.time;
+}
@@ -0,0 +1,45 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include "cdctl_model.h"
+#ifdef SIM_POLLED
+#include "cdctl_bx.h"
+#else
+#include "cdctl_bx_it.h"
+#endif
+
+// two cdctl drivers on two linked cdctl_model, the isrs are called by
+// sim_run, add -DSIM_POLLED to test cdctl_bx.c instead of cdctl_bx_it.c
+
+#ifndef SIM_FRAME_NUM
+#define SIM_FRAME_NUM   20
+#endif
+
+typedef struct {
+    cdctl_model_t   model;
+    cdctl_intf_t    intf;
+    list_head_t     free_head;
+    cd_frame_t      frames[SIM_FRAME_NUM];
+} sim_node_t;
+
+extern sim_node_t sim_a, sim_b; // mac 0x01 and 0x02
+
+int sim_init(cd_mode_t mode, uint32_t baud_l, uint32_t baud_h);
+void sim_run(void);
+
+// virtual time in ns since sim_init
+static inline uint64_t sim_time(void)
+{
+    return max(sim_a.model.time, sim_b.model.time);
+}
+
+#endif
@@ -12,29 +12,59 @@
 #ifdef CDUART_IRQ_SAFE
 #define cduart_frame_get(head)  list_get_entry_it(head, cd_frame_t)
 #define cduart_list_put         list_put_it
+#define cduart_list_put_begin   list_put_begin_it
 #elif !defined(CDUART_USER_LIST)
 #define cduart_frame_get(head)  list_get_entry(head, cd_frame_t)
 #define cduart_list_put         list_put
+#define cduart_list_put_begin   list_put_begin
 #endif
 
 // member functions
 
+// cduart_rx_handle also lowers free_min, maybe from an isr
+static inline void cduart_free_min_update(cduart_intf_t *intf, uint32_t len)
+{
+#ifdef CDUART_IRQ_SAFE
+    uint32_t flags;
+    local_irq_save(flags);
+#endif
+    intf->free_min = min(intf->free_min, len);
+#ifdef CDUART_IRQ_SAFE
+    local_irq_restore(flags);
+#endif
+}
+
 static cd_frame_t *cduart_get_free_frame(cd_intf_t *cd_intf)
 {
     cduart_intf_t *intf = container_of(cd_intf, cduart_intf_t, cd_intf);
-    return cduart_frame_get(intf->free_head);
+    cd_frame_t *frame;
+    if (intf->free_mag) {
+        frame = cd_mag_get_entry(intf->free_mag, cd_frame_t);
+        cduart_free_min_update(intf, cd_mag_len(intf->free_mag));
+    } else {
+        frame = cduart_frame_get(intf->free_head);
+        cduart_free_min_update(intf, intf->free_head->len);
+    }
+    return frame;
 }
 
 static cd_frame_t *cduart_get_rx_frame(cd_intf_t *cd_intf)
 {
     cduart_intf_t *intf = container_of(cd_intf, cduart_intf_t, cd_intf);
+    if (intf->rx_ring)
+        return cd_ring_get(intf->rx_ring);
     return cduart_frame_get(&intf->rx_head);
 }
 
 static void cduart_put_free_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
 {
     cduart_intf_t *intf = container_of(cd_intf, cduart_intf_t, cd_intf);
-    cduart_list_put(intf->free_head, &frame->node);
+    if (intf->rx_ring && cd_ring_has(intf->rx_ring, frame))
+        cd_ring_free(intf->rx_ring, frame);
+    else if (intf->free_mag) // cduart_rx_handle takes from free_head
+        cd_mag_put_keep(intf->free_mag, &frame->node, intf->free_mag->batch);
+    else
+        cduart_list_put(intf->free_head, &frame->node);
 }
 
 static void cduart_put_tx_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
@@ -43,6 +73,15 @@ static void cduart_put_tx_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
     cduart_list_put(&intf->tx_head, &frame->node);
 }
 
+#ifdef cduart_list_put_begin
+// the frame on the wire can't be aborted, only jump the queue
+static void cduart_put_tx_frame_urgent(cd_intf_t *cd_intf, cd_frame_t *frame)
+{
+    cduart_intf_t *intf = container_of(cd_intf, cduart_intf_t, cd_intf);
+    cduart_list_put_begin(&intf->tx_head, &frame->node);
+}
+#endif
+
 
 void cduart_intf_init(cduart_intf_t *intf, list_head_t *free_head)
 {
@@ -54,16 +93,26 @@ void cduart_intf_init(cduart_intf_t *intf, list_head_t *free_head)
     intf->cd_intf.get_rx_frame = cduart_get_rx_frame;
     intf->cd_intf.put_free_frame = cduart_put_free_frame;
     intf->cd_intf.put_tx_frame = cduart_put_tx_frame;
+#ifdef cduart_list_put_begin
+    intf->cd_intf.put_tx_frame_urgent = cduart_put_tx_frame_urgent;
+#elif defined(USE_DYNAMIC_INIT)
+    intf->cd_intf.put_tx_frame_urgent = NULL;
+#endif
 
     intf->t_last = get_systick();
     intf->rx_crc = 0xffff;
+    intf->free_min = 0xffff;
 
 #ifdef USE_DYNAMIC_INIT
     list_head_init(&intf->rx_head);
     list_head_init(&intf->tx_head);
     intf->rx_byte_cnt = 0;
+    intf->rx_no_free_node_cnt = 0;
 
     intf->cd_intf.set_filter = NULL;
+    intf->cd_intf.set_mode = NULL;
+    intf->cd_intf.get_mode = NULL;
+    intf->cd_intf.set_rx_pause = NULL;
     // filters should set by caller
     intf->remote_filter_len = 0;
     intf->local_filter_len = 0;
@@ -150,17 +199,32 @@ void cduart_rx_handle(cduart_intf_t *intf, const uint8_t *buf, int len)
             if (intf->rx_crc != 0) {
                 dn_error(intf->name, "crc error\n");
             } else {
-                cd_frame_t *frm = cduart_frame_get(intf->free_head);
+                cd_frame_t *frm;
+                if (intf->rx_ring)
+                    frm = cd_ring_prepare(intf->rx_ring,
+                            CD_FRAME_SIZE(frame->dat[2] + 3));
+                else {
+                    frm = cduart_frame_get(intf->free_head);
+                    intf->free_min = min(intf->free_min, intf->free_head->len);
+                }
                 if (frm) {
 #ifdef VERBOSE
                     char pbuf[52];
                     hex_dump_small(pbuf, frame->dat, frame->dat[2] + 3, 16);
                     dn_verbose(intf->name, "-> [%s]\n", pbuf);
 #endif
-                    cduart_list_put(&intf->rx_head, &intf->rx_frame->node);
-                    intf->rx_frame = frm;
+                    if (intf->rx_ring) {
+                        // keep rx_frame for the next frame, crc not copied
+                        memcpy(frm->dat, frame->dat, frame->dat[2] + 3);
+                        cd_ring_commit(intf->rx_ring,
+                                CD_FRAME_SIZE(frame->dat[2] + 3));
+                    } else {
+                        cduart_list_put(&intf->rx_head, &intf->rx_frame->node);
+                        intf->rx_frame = frm;
+                    }
                 } else {
                     // set rx_lost flag
+                    intf->rx_no_free_node_cnt++;
                     dn_error(intf->name, "rx_lost\n");
                 }
             }
@@ -12,6 +12,8 @@
 
 #include "cdnet.h"
 #include "modbus_crc.h"
+#include "cd_ring.h"
+#include "cd_mag.h"
 
 #ifndef CDUART_IDLE_TIME
 #define CDUART_IDLE_TIME    (5000 / SYSTICK_US_DIV) // 5 ms
@@ -22,14 +24,24 @@ typedef struct cduart_intf {
     const char          *name;
 
     list_head_t         *free_head;
+    // optional, set before init: cache of free_head for the cd_intf calls,
+    // cduart_rx_handle takes free_head directly, so the cache is returned
+    // once free_head has less than free_mag->batch
+    cd_mag_t            *free_mag;
     list_head_t         rx_head;
     list_head_t         tx_head;
+    // optional, set before init: store rx frames by their real length,
+    // ring frames must be returned to this interface only
+    cd_ring_t           *rx_ring;
 
     cd_frame_t          *rx_frame;  // init: != NULL
     uint16_t            rx_byte_cnt;
     uint16_t            rx_crc;
     uint32_t            t_last;     // last receive time
 
+    uint16_t            free_min;   // lowest free frames since init
+    uint32_t            rx_no_free_node_cnt;
+
     uint8_t             local_filter[8];
     uint8_t             remote_filter[8];
     uint8_t             local_filter_len;
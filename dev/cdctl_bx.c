@@ -31,17 +31,43 @@ static void cdctl_write_reg(cdctl_intf_t *intf, uint8_t reg, uint8_t val)
 #endif
 }
 
-static void cdctl_read_frame(cdctl_intf_t *intf, cd_frame_t *frame)
+static void cdctl_read_rx(cdctl_intf_t *intf, uint8_t *buf, int len)
 {
 #ifdef CDCTL_I2C
-    i2c_mem_read(intf->i2c, REG_RX, frame->dat, 3);
-    i2c_mem_read(intf->i2c, REG_RX, frame->dat + 3, frame->dat[2]);
+    i2c_mem_read(intf->i2c, REG_RX, buf, len);
 #else
-    spi_mem_read(intf->spi, REG_RX, frame->dat, 3);
-    spi_mem_read(intf->spi, REG_RX, frame->dat + 3, frame->dat[2]);
+    spi_mem_read(intf->spi, REG_RX, buf, len);
 #endif
 }
 
+// read the pending frame to the free list or rx_ring, NULL if no space
+static cd_frame_t *cdctl_read_frame(cdctl_intf_t *intf)
+{
+    cd_frame_t *frame;
+    uint8_t hdr[3];
+
+    if (!intf->rx_ring) {
+        frame = list_get_entry(intf->free_head, cd_frame_t);
+        intf->free_min = min(intf->free_min, intf->free_head->len);
+        if (frame) {
+            cdctl_read_rx(intf, frame->dat, 3);
+            cdctl_read_rx(intf, frame->dat + 3, frame->dat[2]);
+        }
+        return frame;
+    }
+
+    cdctl_read_rx(intf, hdr, 3);
+    frame = cd_ring_prepare(intf->rx_ring, CD_FRAME_SIZE(hdr[2] + 3));
+    if (!frame) {
+        // read the header again next time
+        cdctl_write_reg(intf, REG_RX_CTRL, BIT_RX_RST_POINTER);
+        return NULL;
+    }
+    memcpy(frame->dat, hdr, 3);
+    cdctl_read_rx(intf, frame->dat + 3, hdr[2]);
+    return frame;
+}
+
 static void cdctl_write_frame(cdctl_intf_t *intf, const cd_frame_t *frame)
 {
 #ifdef CDCTL_I2C
@@ -56,19 +82,26 @@ static void cdctl_write_frame(cdctl_intf_t *intf, const cd_frame_t *frame)
 static cd_frame_t *cdctl_get_free_frame(cd_intf_t *cd_intf)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    return list_get_entry(intf->free_head, cd_frame_t);
+    cd_frame_t *frame = list_get_entry(intf->free_head, cd_frame_t);
+    intf->free_min = min(intf->free_min, intf->free_head->len);
+    return frame;
 }
 
 static cd_frame_t *cdctl_get_rx_frame(cd_intf_t *cd_intf)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    if (intf->rx_ring)
+        return cd_ring_get(intf->rx_ring);
     return list_get_entry(&intf->rx_head, cd_frame_t);
 }
 
 static void cdctl_put_free_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    list_put(intf->free_head, &frame->node);
+    if (intf->rx_ring && cd_ring_has(intf->rx_ring, frame))
+        cd_ring_free(intf->rx_ring, frame);
+    else
+        list_put(intf->free_head, &frame->node);
 }
 
 static void cdctl_put_tx_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
@@ -77,6 +110,12 @@ static void cdctl_put_tx_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
     list_put(&intf->tx_head, &frame->node);
 }
 
+static void cdctl_put_tx_frame_urgent(cd_intf_t *cd_intf, cd_frame_t *frame)
+{
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    list_put(&intf->tx_urgent_head, &frame->node);
+}
+
 static void cdctl_set_filter(cd_intf_t *cd_intf, uint8_t filter)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
@@ -101,6 +140,33 @@ static uint8_t cdctl_get_tx_wait(cd_intf_t *cd_intf)
     return cdctl_read_reg(intf, REG_TX_WAIT_LEN);
 }
 
+static uint8_t cdctl_setting(cdctl_intf_t *intf)
+{
+    uint8_t setting = BIT_SETTING_TX_PUSH_PULL;
+    if (intf->mode == CD_MODE_P2P)
+        setting |= BIT_SETTING_NO_ARBITRATE;
+    return setting;
+}
+
+static void cdctl_set_mode(cd_intf_t *cd_intf, cd_mode_t mode)
+{
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    intf->mode = mode;
+    cdctl_write_reg(intf, REG_SETTING, cdctl_setting(intf));
+}
+
+static cd_mode_t cdctl_get_mode(cd_intf_t *cd_intf)
+{
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    return intf->mode;
+}
+
+static void cdctl_set_rx_pause(cd_intf_t *cd_intf, bool pause)
+{
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    intf->rx_pause = pause;
+}
+
 static void cdctl_set_baud_rate(cd_intf_t *cd_intf,
         uint32_t low, uint32_t high)
 {
@@ -134,11 +200,13 @@ static void cdctl_flush(cd_intf_t *cd_intf)
     cdctl_write_reg(intf, REG_RX_CTRL, BIT_RX_RST);
 }
 
-void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
-        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
 #ifdef CDCTL_I2C
+void cdctl_intf_setup(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
         i2c_t *i2c, gpio_t *rst_n)
 #else
+void cdctl_intf_setup(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
         spi_t *spi, gpio_t *rst_n)
 #endif
 {
@@ -149,10 +217,14 @@ void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
     intf->cd_intf.get_rx_frame = cdctl_get_rx_frame;
     intf->cd_intf.put_free_frame = cdctl_put_free_frame;
     intf->cd_intf.put_tx_frame = cdctl_put_tx_frame;
+    intf->cd_intf.put_tx_frame_urgent = cdctl_put_tx_frame_urgent;
     intf->cd_intf.set_filter = cdctl_set_filter;
     intf->cd_intf.get_filter = cdctl_get_filter;
     intf->cd_intf.set_tx_wait = cdctl_set_tx_wait;
     intf->cd_intf.get_tx_wait = cdctl_get_tx_wait;
+    intf->cd_intf.set_mode = cdctl_set_mode;
+    intf->cd_intf.get_mode = cdctl_get_mode;
+    intf->cd_intf.set_rx_pause = cdctl_set_rx_pause;
     intf->cd_intf.set_baud_rate = cdctl_set_baud_rate;
     intf->cd_intf.get_baud_rate = cdctl_get_baud_rate;
     intf->cd_intf.flush = cdctl_flush;
@@ -160,9 +232,18 @@ void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
 #ifdef USE_DYNAMIC_INIT
     list_head_init(&intf->rx_head);
     list_head_init(&intf->tx_head);
-    intf->is_pending = false;
+    list_head_init(&intf->tx_urgent_head);
+    intf->tx_pend = NULL;
+    intf->tx_act = NULL;
+    intf->tx_pend_urgent = false;
+    intf->tx_act_urgent = false;
+    intf->rx_pause = false;
+    intf->rx_no_free_node_cnt = 0;
+    intf->tx_abort_cnt = 0;
 #endif
 
+    intf->free_min = 0xffff;
+
 #ifdef CDCTL_I2C
     intf->i2c = i2c;
 #else
@@ -170,35 +251,100 @@ void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
 #endif
     intf->rst_n = rst_n;
 
+    intf->init_filter = filter;
+    intf->init_baud_l = baud_l;
+    intf->init_baud_h = baud_h;
+    intf->init_ver = 0xff;
+    intf->init_same_cnt = 0;
+    intf->init_start = intf->init_time = get_systick();
+
     dn_info(intf->name, "init...\n");
     if (rst_n) {
         gpio_set_value(rst_n, 0);
-        delay_systick(2000/SYSTICK_US_DIV);
-        gpio_set_value(rst_n, 1);
-        delay_systick(2000/SYSTICK_US_DIV);
+        intf->init_state = CDCTL_INIT_RST_LOW;
+    } else {
+        intf->init_state = CDCTL_INIT_PROBE;
     }
+}
 
-    uint8_t last_ver = 0xff;
-    uint8_t same_cnt = 0;
-    while (true) {
-        uint8_t ver = cdctl_read_reg(intf, REG_VERSION);
-        if (ver != 0x00 && ver != 0xff && ver == last_ver) {
-            if (same_cnt++ > 10)
-                break;
-        } else {
-            last_ver = ver;
-            same_cnt = 0;
-        }
-        debug_flush();
-    }
-    dn_info(intf->name, "version: %02x\n", last_ver);
+static void cdctl_init_finish(cdctl_intf_t *intf)
+{
+    dn_info(intf->name, "version: %02x\n", intf->init_ver);
 
-    cdctl_write_reg(intf, REG_SETTING, BIT_SETTING_TX_PUSH_PULL);
-    cdctl_set_filter(&intf->cd_intf, filter);
-    cdctl_set_baud_rate(&intf->cd_intf, baud_l, baud_h);
+    cdctl_write_reg(intf, REG_SETTING, cdctl_setting(intf));
+    cdctl_set_filter(&intf->cd_intf, intf->init_filter);
+    cdctl_set_baud_rate(&intf->cd_intf, intf->init_baud_l, intf->init_baud_h);
     cdctl_flush(&intf->cd_intf);
 
     dn_debug(intf->name, "flags: %02x\n", cdctl_read_reg(intf, REG_INT_FLAG));
+    intf->init_state = CDCTL_INIT_DONE;
+}
+
+// non-blocking, call it for every interface until it returns <= 0
+// return 0: ready, 1: in progress, -1: chip not found
+int cdctl_init_routine(cdctl_intf_t *intf)
+{
+    uint8_t ver;
+
+    switch (intf->init_state) {
+    case CDCTL_INIT_RST_LOW:
+        if (get_systick() - intf->init_time >= CDCTL_RST_TIME) {
+            gpio_set_value(intf->rst_n, 1);
+            intf->init_time = get_systick();
+            intf->init_state = CDCTL_INIT_RST_HIGH;
+        }
+        return 1;
+
+    case CDCTL_INIT_RST_HIGH:
+        if (get_systick() - intf->init_time >= CDCTL_RST_TIME)
+            intf->init_state = CDCTL_INIT_PROBE;
+        return 1;
+
+    case CDCTL_INIT_PROBE:
+        ver = cdctl_read_reg(intf, REG_VERSION);
+        if (ver != 0x00 && ver != 0xff && ver == intf->init_ver) {
+            if (intf->init_same_cnt++ > 10) {
+                cdctl_init_finish(intf);
+                return 0;
+            }
+        } else {
+            intf->init_ver = ver;
+            intf->init_same_cnt = 0;
+        }
+        if (get_systick() - intf->init_start > CDCTL_INIT_TIMEOUT) {
+            dn_error(intf->name, "init timeout, version: %02x\n", ver);
+            intf->init_state = CDCTL_INIT_FAIL;
+            return -1;
+        }
+        return 1;
+
+    case CDCTL_INIT_DONE:
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+// blocking version for single interface, return 0 on success
+#ifdef CDCTL_I2C
+int cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
+        i2c_t *i2c, gpio_t *rst_n)
+{
+    int ret;
+    cdctl_intf_setup(intf, free_head, filter, baud_l, baud_h, i2c, rst_n);
+#else
+int cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
+        spi_t *spi, gpio_t *rst_n)
+{
+    int ret;
+    cdctl_intf_setup(intf, free_head, filter, baud_l, baud_h, spi, rst_n);
+#endif
+    while ((ret = cdctl_init_routine(intf)) > 0)
+        debug_flush();
+    return ret;
 }
 
 // handlers
@@ -206,66 +352,134 @@ void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
 
 void cdctl_routine(cdctl_intf_t *intf)
 {
+    uint8_t rx_ctrl = 0; // error clear bits, folded into next ctrl write
+    uint8_t tx_ctrl = 0;
+
+    if (intf->init_state != CDCTL_INIT_DONE)
+        return;
+
     uint8_t flags = cdctl_read_reg(intf, REG_INT_FLAG);
 
     if (flags & BIT_FLAG_RX_LOST) {
         dn_error(intf->name, "BIT_FLAG_RX_LOST\n");
-        cdctl_write_reg(intf, REG_RX_CTRL, BIT_RX_CLR_LOST);
+        rx_ctrl |= BIT_RX_CLR_LOST;
     }
     if (flags & BIT_FLAG_RX_ERROR) {
         dn_warn(intf->name, "BIT_FLAG_RX_ERROR\n");
-        cdctl_write_reg(intf, REG_RX_CTRL, BIT_RX_CLR_ERROR);
+        rx_ctrl |= BIT_RX_CLR_ERROR;
     }
     if (flags & BIT_FLAG_TX_CD) {
         dn_debug(intf->name, "BIT_FLAG_TX_CD\n");
-        cdctl_write_reg(intf, REG_TX_CTRL, BIT_TX_CLR_CD);
+        tx_ctrl |= BIT_TX_CLR_CD;
     }
     if (flags & BIT_FLAG_TX_ERROR) {
         dn_error(intf->name, "BIT_FLAG_TX_ERROR\n");
-        cdctl_write_reg(intf, REG_TX_CTRL, BIT_TX_CLR_ERROR);
+        tx_ctrl |= BIT_TX_CLR_ERROR;
     }
 
-    if (flags & BIT_FLAG_RX_PENDING) {
-        // if get free list: copy to rx list
-        cd_frame_t *frame = list_get_entry(intf->free_head, cd_frame_t);
-        if (frame) {
-            cdctl_read_frame(intf, frame);
-            cdctl_write_reg(intf, REG_RX_CTRL, BIT_RX_CLR_PENDING);
+    // each loop reuses the flags read at the end of the previous one,
+    // stop when nothing changed or the budget is used up
+    for (int i = 0; i < CDCTL_BURST_MAX; i++) {
+        bool busy = false;
+
+        if ((flags & BIT_FLAG_RX_PENDING) && !intf->rx_pause) {
+            // if get free space: copy to rx list or rx_ring
+            cd_frame_t *frame = cdctl_read_frame(intf);
+            if (frame) {
+                cdctl_write_reg(intf, REG_RX_CTRL, rx_ctrl | BIT_RX_CLR_PENDING);
+                rx_ctrl = 0;
 #ifdef VERBOSE
-            char pbuf[52];
-            hex_dump_small(pbuf, frame->dat, frame->dat[2] + 3, 16);
-            dn_verbose(intf->name, "-> [%s]\n", pbuf);
+                char pbuf[52];
+                hex_dump_small(pbuf, frame->dat, frame->dat[2] + 3, 16);
+                dn_verbose(intf->name, "-> [%s]\n", pbuf);
 #endif
-            list_put(&intf->rx_head, &frame->node);
-        } else {
-            dn_error(intf->name, "get_rx, no free frame\n");
+                if (intf->rx_ring)
+                    cd_ring_commit(intf->rx_ring, CD_FRAME_SIZE(frame->dat[2] + 3));
+                else
+                    list_put(&intf->rx_head, &frame->node);
+                busy = true;
+            } else {
+                intf->rx_no_free_node_cnt++;
+                dn_error(intf->name, "get_rx, no free frame\n");
+            }
         }
-    }
 
-    if (!intf->is_pending && intf->tx_head.first) {
-        cd_frame_t *frame = list_get_entry(&intf->tx_head, cd_frame_t);
-        cdctl_write_frame(intf, frame);
+        // tx_act is sent out once the tx buffer is clean again
+        if (intf->tx_act && (flags & BIT_FLAG_TX_BUF_CLEAN)) {
+            list_put(intf->free_head, &intf->tx_act->node);
+            intf->tx_act = NULL;
+        }
 
-        flags = cdctl_read_reg(intf, REG_INT_FLAG);
-        if (flags & BIT_FLAG_TX_BUF_CLEAN)
-            cdctl_write_reg(intf, REG_TX_CTRL, BIT_TX_START);
-        else
-            intf->is_pending = true;
+        // make room for urgent frames: the non-urgent frames are requeued,
+        // the one started is aborted, it is sent again even if it finished
+        // right before the abort, the seq receivers drop the duplicate
+        if (intf->tx_urgent_head.first) {
+            uint8_t ctrl = 0;
+            if (intf->tx_pend && !intf->tx_pend_urgent) {
+                ctrl |= BIT_TX_RST_POINTER;
+                list_put_begin(&intf->tx_head, &intf->tx_pend->node);
+                intf->tx_pend = NULL;
+            }
+            if (intf->tx_act && !intf->tx_act_urgent) {
+                ctrl |= BIT_TX_ABORT;
+                list_put_begin(&intf->tx_head, &intf->tx_act->node);
+                intf->tx_act = NULL;
+                intf->tx_abort_cnt++;
+            }
+            if (ctrl) {
+                dn_debug(intf->name, "tx abort: %02x\n", ctrl);
+                cdctl_write_reg(intf, REG_TX_CTRL, tx_ctrl | ctrl);
+                tx_ctrl = 0;
+                flags = cdctl_read_reg(intf, REG_INT_FLAG);
+            }
+        }
+
+        if (intf->tx_pend && (flags & BIT_FLAG_TX_BUF_CLEAN)) {
+            dn_verbose(intf->name, "trigger pending tx\n");
+            cdctl_write_reg(intf, REG_TX_CTRL, tx_ctrl | BIT_TX_START);
+            tx_ctrl = 0;
+            intf->tx_act = intf->tx_pend;
+            intf->tx_act_urgent = intf->tx_pend_urgent;
+            intf->tx_pend = NULL;
+            flags &= ~BIT_FLAG_TX_BUF_CLEAN;
+        }
+
+        if (!intf->tx_pend &&
+                (intf->tx_urgent_head.first || intf->tx_head.first)) {
+            cd_frame_t *frame = list_get_entry(&intf->tx_urgent_head, cd_frame_t);
+            bool urgent = !!frame;
+            if (!frame)
+                frame = list_get_entry(&intf->tx_head, cd_frame_t);
+            cdctl_write_frame(intf, frame);
+
+            // the clean flag is only cleared by our BIT_TX_START,
+            // so the flags read before the write still hold
+            if (flags & BIT_FLAG_TX_BUF_CLEAN) {
+                cdctl_write_reg(intf, REG_TX_CTRL, tx_ctrl | BIT_TX_START);
+                tx_ctrl = 0;
+                intf->tx_act = frame;
+                intf->tx_act_urgent = urgent;
+                flags &= ~BIT_FLAG_TX_BUF_CLEAN;
+            } else {
+                intf->tx_pend = frame;
+                intf->tx_pend_urgent = urgent;
+            }
 #ifdef VERBOSE
-        char pbuf[52];
-        hex_dump_small(pbuf, frame->dat, frame->dat[2] + 3, 16);
-        dn_verbose(intf->name, "<- [%s]%s\n",
-                pbuf, intf->is_pending ? " (p)" : "");
+            char pbuf[52];
+            hex_dump_small(pbuf, frame->dat, frame->dat[2] + 3, 16);
+            dn_verbose(intf->name, "<- [%s]%s\n",
+                    pbuf, intf->tx_pend ? " (p)" : "");
 #endif
-        list_put(intf->free_head, &frame->node);
-    }
+            busy = true;
+        }
 
-    if (intf->is_pending) {
+        if (!busy)
+            break;
         flags = cdctl_read_reg(intf, REG_INT_FLAG);
-        if (flags & BIT_FLAG_TX_BUF_CLEAN) {
-            dn_verbose(intf->name, "trigger pending tx\n");
-            cdctl_write_reg(intf, REG_TX_CTRL, BIT_TX_START);
-            intf->is_pending = false;
-        }
     }
+
+    if (rx_ctrl)
+        cdctl_write_reg(intf, REG_RX_CTRL, rx_ctrl);
+    if (tx_ctrl)
+        cdctl_write_reg(intf, REG_TX_CTRL, tx_ctrl);
 }
@@ -11,16 +11,58 @@
 #define __CDCTL_BX_H__
 
 #include "cdnet.h"
+#include "cd_ring.h"
+
+#ifndef CDCTL_INIT_TIMEOUT
+#define CDCTL_INIT_TIMEOUT      (100000 / SYSTICK_US_DIV) // 100 ms
+#endif
+#define CDCTL_RST_TIME          (2000 / SYSTICK_US_DIV) // 2 ms
+
+#ifndef CDCTL_BURST_MAX
+#define CDCTL_BURST_MAX         8 // max rx / tx steps per cdctl_routine
+#endif
+
+typedef enum {
+    CDCTL_INIT_RST_LOW = 0,
+    CDCTL_INIT_RST_HIGH,
+    CDCTL_INIT_PROBE,
+    CDCTL_INIT_DONE,
+    CDCTL_INIT_FAIL
+} cdctl_init_state_t;
 
 typedef struct {
     cd_intf_t   cd_intf;
     const char  *name;
+    cd_mode_t   mode; // set before init, or by cd_intf.set_mode
 
     list_head_t *free_head;
     list_head_t rx_head;
     list_head_t tx_head;
+    list_head_t tx_urgent_head;
+    // optional, set before init: store rx frames by their real length,
+    // ring frames must be returned to this interface only
+    cd_ring_t   *rx_ring;
+
+    bool        rx_pause;   // by cd_intf.set_rx_pause
 
-    bool        is_pending;
+    uint16_t    free_min;   // lowest free_head->len since init
+    uint32_t    rx_no_free_node_cnt;
+    uint32_t    tx_abort_cnt; // started frames requeued for urgent ones
+
+    cd_frame_t  *tx_pend;   // written to tx buffer, not started yet
+    cd_frame_t  *tx_act;    // started, free after tx buffer clean again
+    bool        tx_pend_urgent;
+    bool        tx_act_urgent;
+
+    // init state machine
+    cdctl_init_state_t init_state;
+    uint32_t    init_start;
+    uint32_t    init_time;
+    uint8_t     init_ver;
+    uint8_t     init_same_cnt;
+    uint8_t     init_filter;
+    uint32_t    init_baud_l;
+    uint32_t    init_baud_h;
 
 #ifdef CDCTL_I2C
     i2c_t       *i2c;
@@ -32,14 +74,21 @@ typedef struct {
 
 
 #ifdef CDCTL_I2C
-void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
+void cdctl_intf_setup(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
+        i2c_t *i2c, gpio_t *rst_n);
+int cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
         uint8_t filter, uint32_t baud_l, uint32_t baud_h,
         i2c_t *i2c, gpio_t *rst_n);
 #else
-void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
+void cdctl_intf_setup(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
+        spi_t *spi, gpio_t *rst_n);
+int cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
         uint8_t filter, uint32_t baud_l, uint32_t baud_h,
         spi_t *spi, gpio_t *rst_n);
 #endif
+int cdctl_init_routine(cdctl_intf_t *intf);
 
 void cdctl_routine(cdctl_intf_t *intf);
 
@@ -15,7 +15,7 @@
             BIT_FLAG_TX_CD | BIT_FLAG_TX_ERROR)
 
 
-// used by init and user configuration
+// used by init only, blocking
 static uint8_t cdctl_read_reg(cdctl_intf_t *intf, uint8_t reg)
 {
     uint8_t dat = 0xff;
@@ -45,25 +45,78 @@ static void cdctl_write_reg(cdctl_intf_t *intf, uint8_t reg, uint8_t val)
     }
 }
 
+// for configuration registers: update the shadow register,
+// the write is done by the isr state machine between frames
+static void cdctl_set_reg(cdctl_intf_t *intf, uint8_t reg, uint8_t val)
+{
+    uint32_t flags;
+
+    if (intf->state == CDCTL_RST) {
+        intf->reg_cache[reg] = val;
+        cdctl_write_reg(intf, reg, val);
+        return;
+    }
+    local_irq_save(flags);
+    intf->reg_cache[reg] = val;
+    intf->reg_dirty |= 1 << reg;
+    if (intf->state == CDCTL_IDLE)
+        cdctl_int_isr(intf);
+    local_irq_restore(flags);
+}
+
 
 // member functions
 
+// the isr also lowers free_min, lock so its update is not lost
+static inline void cdctl_free_min_update(cdctl_intf_t *intf, uint32_t len)
+{
+    uint32_t flags;
+    local_irq_save(flags);
+    intf->free_min = min(intf->free_min, len);
+    local_irq_restore(flags);
+}
+
 cd_frame_t *cdctl_get_free_frame(cd_intf_t *cd_intf)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    return list_get_entry_it(intf->free_head, cd_frame_t);
+    cd_frame_t *frame;
+    if (intf->free_mag) {
+        frame = cd_mag_get_entry(intf->free_mag, cd_frame_t);
+        cdctl_free_min_update(intf, cd_mag_len(intf->free_mag));
+    } else {
+        frame = list_get_entry_it(intf->free_head, cd_frame_t);
+        cdctl_free_min_update(intf, intf->free_head->len);
+    }
+    return frame;
 }
 
 cd_frame_t *cdctl_get_rx_frame(cd_intf_t *cd_intf)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+
+    if (intf->rx_irq_off &&
+            (intf->rx_ring ? !intf->rx_ring->rd_num : !intf->rx_head.first) &&
+            get_systick() - intf->rx_drain_time > CDCTL_COALESCE_TIME) {
+        uint32_t flags;
+        local_irq_save(flags);
+        intf->rx_drain_time = get_systick();
+        cdctl_int_isr(intf);
+        local_irq_restore(flags);
+    }
+    if (intf->rx_ring)
+        return cd_ring_get(intf->rx_ring);
     return list_get_entry_it(&intf->rx_head, cd_frame_t);
 }
 
 void cdctl_put_free_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    list_put_it(intf->free_head, &frame->node);
+    if (intf->rx_ring && cd_ring_has(intf->rx_ring, frame))
+        cd_ring_free(intf->rx_ring, frame);
+    else if (intf->free_mag) // the isr takes the rx frames from free_head
+        cd_mag_put_keep(intf->free_mag, &frame->node, intf->free_mag->batch);
+    else
+        list_put_it(intf->free_head, &frame->node);
 }
 
 void cdctl_put_tx_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
@@ -78,29 +131,74 @@ void cdctl_put_tx_frame(cd_intf_t *cd_intf, cd_frame_t *frame)
     local_irq_restore(flags);
 }
 
+void cdctl_put_tx_frame_urgent(cd_intf_t *cd_intf, cd_frame_t *frame)
+{
+    uint32_t flags;
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    local_irq_save(flags);
+    intf->tx_cnt++;
+    list_put(&intf->tx_urgent_head, &frame->node);
+    if (intf->state == CDCTL_IDLE || intf->state == CDCTL_WAIT_TX_CLEAN)
+        cdctl_int_isr(intf);
+    local_irq_restore(flags);
+}
+
 
 static void cdctl_set_filter(cd_intf_t *cd_intf, uint8_t filter)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    cdctl_write_reg(intf, REG_FILTER, filter);
+    cdctl_set_reg(intf, REG_FILTER, filter);
 }
 
 static uint8_t cdctl_get_filter(cd_intf_t *cd_intf)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    return cdctl_read_reg(intf, REG_FILTER);
+    return intf->reg_cache[REG_FILTER];
 }
 
 static void cdctl_set_tx_wait(cd_intf_t *cd_intf, uint8_t len)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    cdctl_write_reg(intf, REG_TX_WAIT_LEN, max(1, len));
+    cdctl_set_reg(intf, REG_TX_WAIT_LEN, max(1, len));
 }
 
 static uint8_t cdctl_get_tx_wait(cd_intf_t *cd_intf)
 {
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    return cdctl_read_reg(intf, REG_TX_WAIT_LEN);
+    return intf->reg_cache[REG_TX_WAIT_LEN];
+}
+
+static uint8_t cdctl_setting(cdctl_intf_t *intf)
+{
+    uint8_t setting = BIT_SETTING_TX_PUSH_PULL;
+    if (intf->mode == CD_MODE_P2P)
+        setting |= BIT_SETTING_NO_ARBITRATE;
+    return setting;
+}
+
+static void cdctl_set_mode(cd_intf_t *cd_intf, cd_mode_t mode)
+{
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    intf->mode = mode;
+    cdctl_set_reg(intf, REG_SETTING, cdctl_setting(intf));
+}
+
+static cd_mode_t cdctl_get_mode(cd_intf_t *cd_intf)
+{
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    return intf->mode;
+}
+
+// the rx_pending irq is masked while paused, the pending frames are read
+// after resume, the controller reports rx_lost once its pages are full
+static void cdctl_set_rx_pause(cd_intf_t *cd_intf, bool pause)
+{
+    uint32_t flags;
+    cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
+    local_irq_save(flags);
+    intf->rx_pause = pause;
+    cdctl_int_isr(intf); // update the int mask if idle
+    local_irq_restore(flags);
 }
 
 static void cdctl_set_baud_rate(cd_intf_t *cd_intf,
@@ -110,10 +208,10 @@ static void cdctl_set_baud_rate(cd_intf_t *cd_intf,
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
     l = DIV_ROUND_CLOSEST(CDCTL_SYS_CLK, low) - 1;
     h = DIV_ROUND_CLOSEST(CDCTL_SYS_CLK, high) - 1;
-    cdctl_write_reg(intf, REG_DIV_LS_L, l & 0xff);
-    cdctl_write_reg(intf, REG_DIV_LS_H, l >> 8);
-    cdctl_write_reg(intf, REG_DIV_HS_L, h & 0xff);
-    cdctl_write_reg(intf, REG_DIV_HS_H, h >> 8);
+    cdctl_set_reg(intf, REG_DIV_LS_L, l & 0xff);
+    cdctl_set_reg(intf, REG_DIV_LS_H, l >> 8);
+    cdctl_set_reg(intf, REG_DIV_HS_L, h & 0xff);
+    cdctl_set_reg(intf, REG_DIV_HS_H, h >> 8);
     dn_debug(intf->name, "set baud rate: %u %u (%u %u)\n", low, high, l, h);
 }
 
@@ -122,22 +220,30 @@ static void cdctl_get_baud_rate(cd_intf_t *cd_intf,
 {
     uint16_t l, h;
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    l = cdctl_read_reg(intf, REG_DIV_LS_L) |
-            cdctl_read_reg(intf, REG_DIV_LS_H) << 8;
-    h = cdctl_read_reg(intf, REG_DIV_HS_L) |
-            cdctl_read_reg(intf, REG_DIV_HS_H) << 8;
+    l = intf->reg_cache[REG_DIV_LS_L] | intf->reg_cache[REG_DIV_LS_H] << 8;
+    h = intf->reg_cache[REG_DIV_HS_L] | intf->reg_cache[REG_DIV_HS_H] << 8;
     *low = DIV_ROUND_CLOSEST(CDCTL_SYS_CLK, l + 1);
     *high = DIV_ROUND_CLOSEST(CDCTL_SYS_CLK, h + 1);
 }
 
 static void cdctl_flush(cd_intf_t *cd_intf)
 {
+    uint32_t flags;
     cdctl_intf_t *intf = container_of(cd_intf, cdctl_intf_t, cd_intf);
-    cdctl_write_reg(intf, REG_RX_CTRL, BIT_RX_RST);
+
+    if (intf->state == CDCTL_RST) {
+        cdctl_write_reg(intf, REG_RX_CTRL, BIT_RX_RST);
+        return;
+    }
+    local_irq_save(flags);
+    intf->rx_ctrl |= BIT_RX_RST;
+    if (intf->state == CDCTL_IDLE)
+        cdctl_int_isr(intf);
+    local_irq_restore(flags);
 }
 
 
-void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
+void cdctl_intf_setup(cdctl_intf_t *intf, list_head_t *free_head,
         uint8_t filter, uint32_t baud_l, uint32_t baud_h,
         spi_t *spi, gpio_t *rst_n, gpio_t *int_n)
 {
@@ -149,10 +255,14 @@ void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
     intf->cd_intf.get_rx_frame = cdctl_get_rx_frame;
     intf->cd_intf.put_free_frame = cdctl_put_free_frame;
     intf->cd_intf.put_tx_frame = cdctl_put_tx_frame;
+    intf->cd_intf.put_tx_frame_urgent = cdctl_put_tx_frame_urgent;
     intf->cd_intf.set_filter = cdctl_set_filter;
     intf->cd_intf.get_filter = cdctl_get_filter;
     intf->cd_intf.set_tx_wait = cdctl_set_tx_wait;
     intf->cd_intf.get_tx_wait = cdctl_get_tx_wait;
+    intf->cd_intf.set_mode = cdctl_set_mode;
+    intf->cd_intf.get_mode = cdctl_get_mode;
+    intf->cd_intf.set_rx_pause = cdctl_set_rx_pause;
     intf->cd_intf.set_baud_rate = cdctl_set_baud_rate;
     intf->cd_intf.get_baud_rate = cdctl_get_baud_rate;
     intf->cd_intf.flush = cdctl_flush;
@@ -162,55 +272,132 @@ void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
     intf->manual_ctrl = false;
     list_head_init(&intf->rx_head);
     list_head_init(&intf->tx_head);
+    list_head_init(&intf->tx_urgent_head);
+    intf->tx_pend = NULL;
+    intf->tx_act = NULL;
+    intf->tx_pend_urgent = false;
+    intf->tx_act_urgent = false;
     intf->tx_wait_trigger = false;
-    intf->tx_buf_clean_mask = false;
+    intf->tx_clean = false;
+    intf->rx_drain = 0;
+    intf->rx_batch = 0;
+    intf->rx_irq_off = false;
+    intf->rx_pause = false;
+    intf->rx_ctrl = 0;
+    intf->tx_ctrl = 0;
+    intf->reg_dirty = 0;
     intf->rx_cnt = 0;
     intf->tx_cnt = 0;
     intf->rx_lost_cnt = 0;
     intf->rx_error_cnt = 0;
     intf->tx_cd_cnt = 0;
     intf->tx_error_cnt = 0;
+    intf->tx_abort_cnt = 0;
+    intf->tx_done_cnt = 0;
+    intf->tx_wait_cd_cnt = 0;
+    intf->tx_wait_tx_cnt = 0;
     intf->rx_no_free_node_cnt = 0;
 #endif
 
+    intf->free_min = 0xffff;
     intf->spi = spi;
     intf->rst_n = rst_n;
     intf->int_n = int_n;
 
+    intf->init_filter = filter;
+    intf->init_baud_l = baud_l;
+    intf->init_baud_h = baud_h;
+    intf->init_ver = 0xff;
+    intf->init_same_cnt = 0;
+    intf->init_start = intf->init_time = get_systick();
+
     dn_info(intf->name, "init...\n");
     if (rst_n) {
         gpio_set_value(rst_n, 0);
-        delay_systick(2000/SYSTICK_US_DIV);
-        gpio_set_value(rst_n, 1);
-        delay_systick(2000/SYSTICK_US_DIV);
+        intf->init_state = CDCTL_INIT_RST_LOW;
+    } else {
+        intf->init_state = CDCTL_INIT_PROBE;
     }
+}
 
-    uint8_t last_ver = 0xff;
-    uint8_t same_cnt = 0;
-    while (true) {
-        uint8_t ver = cdctl_read_reg(intf, REG_VERSION);
-        if (ver != 0x00 && ver != 0xff && ver == last_ver) {
-            if (same_cnt++ > 10)
-                break;
-        } else {
-            last_ver = ver;
-            same_cnt = 0;
-        }
-        debug_flush();
-    }
-    dn_info(intf->name, "version: %02x\n", last_ver);
+static void cdctl_init_finish(cdctl_intf_t *intf)
+{
+    dn_info(intf->name, "version: %02x\n", intf->init_ver);
 
-    cdctl_write_reg(intf, REG_SETTING, BIT_SETTING_TX_PUSH_PULL);
-    cdctl_set_filter(&intf->cd_intf, filter);
-    cdctl_set_baud_rate(&intf->cd_intf, baud_l, baud_h);
+    for (uint32_t i = 0; i < sizeof(intf->reg_cache); i++)
+        intf->reg_cache[i] = cdctl_read_reg(intf, i);
+    cdctl_set_reg(intf, REG_SETTING, cdctl_setting(intf));
+    cdctl_set_filter(&intf->cd_intf, intf->init_filter);
+    cdctl_set_baud_rate(&intf->cd_intf, intf->init_baud_l, intf->init_baud_h);
     cdctl_flush(&intf->cd_intf);
 
     dn_debug(intf->name, "flags: %02x\n", cdctl_read_reg(intf, REG_INT_FLAG));
-    cdctl_write_reg(intf, REG_INT_MASK, CDCTL_MASK);
+    intf->int_mask = CDCTL_MASK;
+    cdctl_write_reg(intf, REG_INT_MASK, intf->int_mask);
+    intf->init_state = CDCTL_INIT_DONE;
     intf->state = CDCTL_IDLE;
     // enable int_n interrupt at outside
 }
 
+// non-blocking, call it for every interface until it returns <= 0
+// return 0: ready, 1: in progress, -1: chip not found
+int cdctl_init_routine(cdctl_intf_t *intf)
+{
+    uint8_t ver;
+
+    switch (intf->init_state) {
+    case CDCTL_INIT_RST_LOW:
+        if (get_systick() - intf->init_time >= CDCTL_RST_TIME) {
+            gpio_set_value(intf->rst_n, 1);
+            intf->init_time = get_systick();
+            intf->init_state = CDCTL_INIT_RST_HIGH;
+        }
+        return 1;
+
+    case CDCTL_INIT_RST_HIGH:
+        if (get_systick() - intf->init_time >= CDCTL_RST_TIME)
+            intf->init_state = CDCTL_INIT_PROBE;
+        return 1;
+
+    case CDCTL_INIT_PROBE:
+        ver = cdctl_read_reg(intf, REG_VERSION);
+        if (ver != 0x00 && ver != 0xff && ver == intf->init_ver) {
+            if (intf->init_same_cnt++ > 10) {
+                cdctl_init_finish(intf);
+                return 0;
+            }
+        } else {
+            intf->init_ver = ver;
+            intf->init_same_cnt = 0;
+        }
+        if (get_systick() - intf->init_start > CDCTL_INIT_TIMEOUT) {
+            dn_error(intf->name, "init timeout, version: %02x\n", ver);
+            intf->init_state = CDCTL_INIT_FAIL;
+            return -1;
+        }
+        return 1;
+
+    case CDCTL_INIT_DONE:
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+// blocking version for single interface, return 0 on success
+int cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
+        spi_t *spi, gpio_t *rst_n, gpio_t *int_n)
+{
+    int ret;
+    cdctl_intf_setup(intf, free_head, filter, baud_l, baud_h,
+            spi, rst_n, int_n);
+    while ((ret = cdctl_init_routine(intf)) > 0)
+        debug_flush();
+    return ret;
+}
+
 
 static inline
 void cdctl_read_reg_it(cdctl_intf_t *intf, uint8_t reg)
@@ -229,6 +416,162 @@ void cdctl_write_reg_it(cdctl_intf_t *intf, uint8_t reg, uint8_t val)
     spi_dma_write(intf->spi, intf->buf, 2);
 }
 
+static inline
+bool cdctl_tx_ready(cdctl_intf_t *intf)
+{
+    return intf->tx_urgent_head.first || intf->tx_head.first;
+}
+
+// write the whole frame by one dma, stage the reg address in front of it
+// (dat[2] + 4 <= 259), undo by cdctl_tx_requeue_it if it is not started
+static inline
+void cdctl_write_frame_it(cdctl_intf_t *intf)
+{
+    cd_frame_t *frame = list_get_entry_it(&intf->tx_urgent_head, cd_frame_t);
+    intf->tx_pend_urgent = !!frame;
+    if (!frame)
+        frame = list_get_entry_it(&intf->tx_head, cd_frame_t);
+    intf->tx_pend = frame;
+    memmove(frame->dat + 1, frame->dat, frame->dat[2] + 3);
+    frame->dat[0] = REG_TX | 0x80;
+    intf->state = CDCTL_TX_FRAME;
+    gpio_set_value(intf->spi->ns_pin, 0);
+    spi_dma_write(intf->spi, frame->dat, frame->dat[3] + 4);
+}
+
+static inline
+void cdctl_read_header_it(cdctl_intf_t *intf)
+{
+    intf->state = CDCTL_RX_HEADER;
+    intf->buf[0] = REG_RX;
+    gpio_set_value(intf->spi->ns_pin, 0);
+    spi_dma_write_read(intf->spi, intf->buf, intf->buf, 4);
+}
+
+static inline
+uint8_t cdctl_int_mask(cdctl_intf_t *intf)
+{
+    uint8_t mask = CDCTL_MASK;
+    // also for releasing tx_act after the last frame
+    if (intf->tx_wait_trigger || intf->tx_act)
+        mask |= BIT_FLAG_TX_BUF_CLEAN;
+    if (intf->rx_irq_off || intf->rx_pause)
+        mask &= ~BIT_FLAG_RX_PENDING;
+    return mask;
+}
+
+static inline
+void cdctl_tx_requeue_it(cdctl_intf_t *intf, cd_frame_t *frame)
+{
+    memmove(frame->dat, frame->dat + 1, frame->dat[3] + 3);
+    list_put_begin_it(&intf->tx_head, &frame->node);
+}
+
+// make room for urgent frames: the non-urgent frames are requeued, the one
+// started is aborted, it is sent again even if it finished right before the
+// abort, the seq receivers drop the duplicate
+static inline
+bool cdctl_tx_abort_it(cdctl_intf_t *intf)
+{
+    uint8_t ctrl = 0;
+    if (!intf->tx_urgent_head.first)
+        return false;
+
+    if (intf->tx_pend && !intf->tx_pend_urgent) {
+        ctrl |= BIT_TX_RST_POINTER;
+        cdctl_tx_requeue_it(intf, intf->tx_pend);
+        intf->tx_pend = NULL;
+        intf->tx_wait_trigger = false;
+    }
+    if (intf->tx_act && !intf->tx_act_urgent) {
+        ctrl |= BIT_TX_ABORT;
+        cdctl_tx_requeue_it(intf, intf->tx_act); // before tx_pend
+        intf->tx_act = NULL;
+        intf->tx_abort_cnt++;
+    }
+    if (!ctrl)
+        return false;
+
+    intf->tx_clean = false;
+    intf->state = CDCTL_TX_CTRL;
+    cdctl_write_reg_it(intf, REG_TX_CTRL, intf->tx_ctrl | ctrl);
+    intf->tx_ctrl = 0;
+    return true;
+}
+
+// called from isr after the flags read: back off quickly on collisions,
+// shrink the wait slowly on a quiet bus, faster if our tx queue grows,
+// the new value is written by the reg_dirty step
+static inline
+void cdctl_tx_wait_adapt_it(cdctl_intf_t *intf)
+{
+    if (!intf->tx_wait_max ||
+            get_systick() - intf->tx_wait_time < CDCTL_TX_WAIT_PERIOD)
+        return;
+    intf->tx_wait_time = get_systick();
+
+    uint32_t cd_cnt = intf->tx_cd_cnt + intf->tx_error_cnt;
+    uint32_t collide = cd_cnt - intf->tx_wait_cd_cnt;
+    uint32_t tx = intf->tx_done_cnt - intf->tx_wait_tx_cnt;
+    int wait = intf->reg_cache[REG_TX_WAIT_LEN];
+    intf->tx_wait_cd_cnt = cd_cnt;
+    intf->tx_wait_tx_cnt = intf->tx_done_cnt;
+
+    if (collide * 8 > tx)
+        wait *= 2;
+    else if (collide)
+        wait++;
+    else if (tx)
+        wait -= intf->tx_head.len > 2 ? 2 : 1;
+    wait = clip(wait, max(1, intf->tx_wait_min), intf->tx_wait_max);
+
+    if (wait != intf->reg_cache[REG_TX_WAIT_LEN]) {
+        intf->reg_cache[REG_TX_WAIT_LEN] = wait;
+        intf->reg_dirty |= 1 << REG_TX_WAIT_LEN;
+    }
+}
+
+static inline
+void cdctl_tx_start_it(cdctl_intf_t *intf)
+{
+    intf->tx_act = intf->tx_pend;
+    intf->tx_act_urgent = intf->tx_pend_urgent;
+    intf->tx_pend = NULL;
+    intf->tx_wait_trigger = false;
+    intf->tx_clean = false;
+    intf->state = CDCTL_TX_CTRL;
+    cdctl_write_reg_it(intf, REG_TX_CTRL, intf->tx_ctrl | BIT_TX_START);
+    intf->tx_ctrl = 0;
+}
+
+static inline
+void cdctl_write_dirty_it(cdctl_intf_t *intf)
+{
+    uint8_t reg = __builtin_ctz(intf->reg_dirty);
+    intf->reg_dirty &= ~(1 << reg);
+    intf->state = CDCTL_WR_REG;
+    cdctl_write_reg_it(intf, reg, intf->reg_cache[reg]);
+}
+
+// after a ctrl write, read the flags only if necessary
+static inline
+void cdctl_next_it(cdctl_intf_t *intf)
+{
+    if (intf->rx_drain) {
+        cdctl_read_header_it(intf);
+    } else if (!gpio_get_value(intf->int_n) || intf->tx_wait_trigger ||
+            cdctl_int_mask(intf) != intf->int_mask) {
+        intf->state = CDCTL_RD_FLAG;
+        cdctl_read_reg_it(intf, REG_INT_FLAG);
+    } else if (intf->reg_dirty) {
+        cdctl_write_dirty_it(intf);
+    } else if (cdctl_tx_ready(intf)) {
+        cdctl_write_frame_it(intf);
+    } else {
+        intf->state = CDCTL_IDLE;
+    }
+}
+
 // handlers
 
 // int_n pin interrupt isr
@@ -247,78 +590,88 @@ void cdctl_spi_isr(cdctl_intf_t *intf)
     // end of CDCTL_RD_FLAG
     if (intf->state == CDCTL_RD_FLAG) {
         uint8_t val = intf->buf[1];
-        uint8_t ret = 0;
         gpio_set_value(intf->spi->ns_pin, 1);
 
-        // check rx error
-        if (val & BIT_FLAG_RX_LOST) {
-            ret |= BIT_RX_CLR_LOST;
+        // errors are cleared together with the next ctrl write
+        if ((val & BIT_FLAG_RX_LOST) && !(intf->rx_ctrl & BIT_RX_CLR_LOST)) {
+            intf->rx_ctrl |= BIT_RX_CLR_LOST;
             intf->rx_lost_cnt++;
         }
-        if (val & BIT_FLAG_RX_ERROR) {
-            ret |= BIT_RX_CLR_ERROR;
+        if ((val & BIT_FLAG_RX_ERROR) && !(intf->rx_ctrl & BIT_RX_CLR_ERROR)) {
+            intf->rx_ctrl |= BIT_RX_CLR_ERROR;
             intf->rx_error_cnt++;
         }
-        if (ret) {
-            intf->state = CDCTL_RX_CTRL;
-            cdctl_write_reg_it(intf, REG_RX_CTRL, ret);
-            return;
-        }
-
-        // check tx error
-        if (val & BIT_FLAG_TX_CD) {
-            ret |= BIT_TX_CLR_CD;
+        if ((val & BIT_FLAG_TX_CD) && !(intf->tx_ctrl & BIT_TX_CLR_CD)) {
+            intf->tx_ctrl |= BIT_TX_CLR_CD;
             intf->tx_cd_cnt++;
         }
-        if (val & BIT_FLAG_TX_ERROR) {
-            ret |= BIT_TX_CLR_ERROR;
+        if ((val & BIT_FLAG_TX_ERROR) && !(intf->tx_ctrl & BIT_TX_CLR_ERROR)) {
+            intf->tx_ctrl |= BIT_TX_CLR_ERROR;
             intf->tx_error_cnt++;
         }
-        if (ret) {
-            intf->state = CDCTL_TX_CTRL;
-            cdctl_write_reg_it(intf, REG_TX_CTRL, ret);
+
+        // tx_act is sent out once the tx buffer is clean again
+        intf->tx_clean = !!(val & BIT_FLAG_TX_BUF_CLEAN);
+        if (intf->tx_act && intf->tx_clean) {
+            list_put_it(intf->free_head, &intf->tx_act->node);
+            intf->tx_act = NULL;
+            intf->tx_done_cnt++;
+        }
+        cdctl_tx_wait_adapt_it(intf);
+        if (cdctl_tx_abort_it(intf))
+            return;
+
+        // start the preloaded frame before anything else,
+        // the next one is written while it is on the wire
+        if (intf->tx_wait_trigger && intf->tx_clean) {
+            cdctl_tx_start_it(intf);
+            return;
+        }
+
+        // check for new frames, read all pending pages at once
+        if ((val & BIT_FLAG_RX_PENDING) && !intf->rx_pause) {
+            intf->state = CDCTL_RX_PAGE;
+            cdctl_read_reg_it(intf, REG_RX_PAGE_FLAG);
             return;
         }
 
-        // check for new frame
-        if (val & BIT_FLAG_RX_PENDING) {
-            intf->state = CDCTL_RX_HEADER;
-            intf->buf[0] = REG_RX;
-            gpio_set_value(intf->spi->ns_pin, 0);
-            spi_dma_write_read(intf->spi, intf->buf, intf->buf, 4);
+        // user configuration
+        if (intf->reg_dirty) {
+            cdctl_write_dirty_it(intf);
             return;
         }
 
         // check for tx
         if (intf->tx_wait_trigger) {
-            if (val & BIT_FLAG_TX_BUF_CLEAN) {
-                intf->tx_wait_trigger = false;
-
-                intf->state = CDCTL_TX_CTRL;
-                cdctl_write_reg_it(intf, REG_TX_CTRL, BIT_TX_START);
-                return;
-            } else if (!intf->tx_buf_clean_mask) {
+            if (!(intf->int_mask & BIT_FLAG_TX_BUF_CLEAN)) {
                 // enable tx_buf_clean irq
-                intf->tx_buf_clean_mask = true;
-                intf->state = CDCTL_TX_MASK;
-                cdctl_write_reg_it(intf, REG_INT_MASK,
-                        CDCTL_MASK | BIT_FLAG_TX_BUF_CLEAN);
+                intf->int_mask = cdctl_int_mask(intf);
+                intf->state = CDCTL_INT_MASK;
+                cdctl_write_reg_it(intf, REG_INT_MASK, intf->int_mask);
                 return;
             }
-        } else if (intf->tx_head.first) {
-            cd_frame_t *frame = list_entry(intf->tx_head.first, cd_frame_t);
-            intf->buf[0] = REG_TX | 0x80;
-            memcpy(intf->buf + 1, frame->dat, 3);
-            intf->state = CDCTL_TX_HEADER;
-            gpio_set_value(intf->spi->ns_pin, 0);
-            spi_dma_write(intf->spi, intf->buf, 4);
+        } else if (cdctl_tx_ready(intf)) {
+            cdctl_write_frame_it(intf);
+            return;
+        }
+
+        if (intf->rx_ctrl) {
+            intf->state = CDCTL_RX_CTRL;
+            cdctl_write_reg_it(intf, REG_RX_CTRL, intf->rx_ctrl);
+            intf->rx_ctrl = 0;
+            return;
+        }
+        if (intf->tx_ctrl) {
+            intf->state = CDCTL_TX_CTRL;
+            cdctl_write_reg_it(intf, REG_TX_CTRL, intf->tx_ctrl);
+            intf->tx_ctrl = 0;
             return;
         }
 
-        if (intf->tx_buf_clean_mask) {
-            intf->tx_buf_clean_mask = false;
-            intf->state = CDCTL_TX_MASK;
-            cdctl_write_reg_it(intf, REG_INT_MASK, CDCTL_MASK);
+        if (cdctl_int_mask(intf) != intf->int_mask) {
+            intf->int_mask = cdctl_int_mask(intf);
+            intf->state = CDCTL_INT_MASK;
+            cdctl_write_reg_it(intf, REG_INT_MASK, intf->int_mask);
             return;
         }
 
@@ -328,23 +681,38 @@ void cdctl_spi_isr(cdctl_intf_t *intf)
         return;
     }
 
-    // end of CDCTL_RX_CTRL, TX_CTRL, TX_MASK
+    // end of CDCTL_RX_CTRL, TX_CTRL, INT_MASK, WR_REG
     if (intf->state == CDCTL_RX_CTRL ||
             intf->state == CDCTL_TX_CTRL ||
-            intf->state == CDCTL_TX_MASK) {
+            intf->state == CDCTL_INT_MASK ||
+            intf->state == CDCTL_WR_REG) {
         gpio_set_value(intf->spi->ns_pin, 1);
-        intf->state = CDCTL_RD_FLAG;
-        cdctl_read_reg_it(intf, REG_INT_FLAG);
+        cdctl_next_it(intf);
+        return;
+    }
+
+    // end of CDCTL_RX_PAGE
+    if (intf->state == CDCTL_RX_PAGE) {
+        gpio_set_value(intf->spi->ns_pin, 1);
+        intf->rx_batch = max(1, __builtin_popcount(intf->buf[1]));
+        intf->rx_drain = intf->rx_batch;
+        cdctl_read_header_it(intf);
         return;
     }
 
     // end of CDCTL_RX_HEADER
     if (intf->state == CDCTL_RX_HEADER) {
-        memcpy(intf->rx_frame->dat, intf->buf + 1, 3);
+        intf->rx_cur = NULL;
+        if (intf->rx_ring)
+            intf->rx_cur = cd_ring_prepare(intf->rx_ring,
+                    CD_FRAME_SIZE(intf->buf[3] + 3));
+        if (!intf->rx_cur)
+            intf->rx_cur = intf->rx_frame; // also drop to here if no space
+        memcpy(intf->rx_cur->dat, intf->buf + 1, 3);
         intf->state = CDCTL_RX_BODY;
-        if (intf->rx_frame->dat[2] != 0) {
-            spi_dma_read(intf->spi, intf->rx_frame->dat + 3,
-                    intf->rx_frame->dat[2]);
+        if (intf->rx_cur->dat[2] != 0) {
+            spi_dma_read(intf->spi, intf->rx_cur->dat + 3,
+                    intf->rx_cur->dat[2]);
             return;
         } // else goto next if block directly
     }
@@ -352,36 +720,48 @@ void cdctl_spi_isr(cdctl_intf_t *intf)
     // end of CDCTL_RX_BODY
     if (intf->state == CDCTL_RX_BODY) {
         gpio_set_value(intf->spi->ns_pin, 1);
-        cd_frame_t *frame = list_get_entry_it(intf->free_head, cd_frame_t);
-        if (frame) {
-            list_put_it(&intf->rx_head, &intf->rx_frame->node);
-            intf->rx_frame = frame;
+        if (intf->rx_cur != intf->rx_frame) {
+            cd_ring_commit(intf->rx_ring,
+                    CD_FRAME_SIZE(intf->rx_cur->dat[2] + 3));
             intf->rx_cnt++;
-        } else {
+        } else if (intf->rx_ring) {
             intf->rx_no_free_node_cnt++;
+        } else {
+            cd_frame_t *frame = list_get_entry_it(intf->free_head, cd_frame_t);
+            intf->free_min = min(intf->free_min, intf->free_head->len);
+            if (frame) {
+                list_put_it(&intf->rx_head, &intf->rx_frame->node);
+                intf->rx_frame = frame;
+                intf->rx_cnt++;
+            } else {
+                intf->rx_no_free_node_cnt++;
+            }
+        }
+        if (!--intf->rx_drain) {
+            // keep rx irq off under heavy load
+            intf->rx_irq_off = intf->rx_coalesce &&
+                    intf->rx_batch >= intf->rx_coalesce;
+            intf->rx_drain_time = get_systick();
         }
         intf->state = CDCTL_RX_CTRL;
-        cdctl_write_reg_it(intf, REG_RX_CTRL, BIT_RX_CLR_PENDING);
+        cdctl_write_reg_it(intf, REG_RX_CTRL,
+                intf->rx_ctrl | BIT_RX_CLR_PENDING);
+        intf->rx_ctrl = 0;
         return;
     }
 
-    // end of CDCTL_TX_HEADER
-    if (intf->state == CDCTL_TX_HEADER) {
-        cd_frame_t *frame = list_entry(intf->tx_head.first, cd_frame_t);
-        intf->state = CDCTL_TX_BODY;
-        if (frame->dat[2] != 0) {
-            spi_dma_write(intf->spi, frame->dat + 3, frame->dat[2]);
-            return;
-        } // else goto next if block directly
-    }
-
-    // end of CDCTL_TX_BODY
-    if (intf->state == CDCTL_TX_BODY) {
+    // end of CDCTL_TX_FRAME
+    if (intf->state == CDCTL_TX_FRAME) {
         gpio_set_value(intf->spi->ns_pin, 1);
 
-        list_put_it(intf->free_head, list_get_it(&intf->tx_head));
         intf->tx_wait_trigger = true;
 
+        // the clean flag is only cleared by our tx_start
+        if (intf->tx_clean && (intf->tx_pend_urgent ||
+                    !intf->tx_urgent_head.first)) {
+            cdctl_tx_start_it(intf);
+            return;
+        }
         intf->state = CDCTL_RD_FLAG;
         cdctl_read_reg_it(intf, REG_INT_FLAG);
         return;
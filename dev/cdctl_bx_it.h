@@ -11,6 +11,27 @@
 #define __CDCTL_BX_IT_H__
 
 #include "cdnet.h"
+#include "cd_ring.h"
+#include "cd_mag.h"
+
+#ifndef CDCTL_COALESCE_TIME
+#define CDCTL_COALESCE_TIME     (1000 / SYSTICK_US_DIV) // 1 ms
+#endif
+#ifndef CDCTL_TX_WAIT_PERIOD
+#define CDCTL_TX_WAIT_PERIOD    (50000 / SYSTICK_US_DIV) // 50 ms
+#endif
+#ifndef CDCTL_INIT_TIMEOUT
+#define CDCTL_INIT_TIMEOUT      (100000 / SYSTICK_US_DIV) // 100 ms
+#endif
+#define CDCTL_RST_TIME          (2000 / SYSTICK_US_DIV) // 2 ms
+
+typedef enum {
+    CDCTL_INIT_RST_LOW = 0,
+    CDCTL_INIT_RST_HIGH,
+    CDCTL_INIT_PROBE,
+    CDCTL_INIT_DONE,
+    CDCTL_INIT_FAIL
+} cdctl_init_state_t;
 
 typedef enum {
     CDCTL_RST = 0,
@@ -19,40 +40,92 @@ typedef enum {
     CDCTL_WAIT_TX_CLEAN,
     CDCTL_RD_FLAG,
 
+    CDCTL_RX_PAGE,
     CDCTL_RX_HEADER,
     CDCTL_RX_BODY,
     CDCTL_RX_CTRL,
 
-    CDCTL_TX_HEADER,
-    CDCTL_TX_BODY,
+    CDCTL_TX_FRAME,
     CDCTL_TX_CTRL,
-    CDCTL_TX_MASK
+    CDCTL_INT_MASK,
+    CDCTL_WR_REG
 } cdctl_state_t;
 
 typedef struct {
     cd_intf_t       cd_intf;
     const char      *name;
+    cd_mode_t       mode; // set before init, or by cd_intf.set_mode
 
     cdctl_state_t   state;
     bool            manual_ctrl;
 
     list_head_t     *free_head;
+    // optional, set before init: cache of free_head for the cd_intf calls
+    // from the main loop, the isr takes free_head directly, so the cache is
+    // returned once free_head has less than free_mag->batch
+    cd_mag_t        *free_mag;
     list_head_t     rx_head;
     list_head_t     tx_head;
-
-    cd_frame_t      *rx_frame;
+    list_head_t     tx_urgent_head;
+    // optional, set before init: store rx frames by their real length,
+    // ring frames must be returned to this interface only
+    cd_ring_t       *rx_ring;
+
+    cd_frame_t      *rx_frame; // rx buffer for the free list mode, or drop
+    cd_frame_t      *rx_cur;   // frame in reading, rx_frame or from rx_ring
+    cd_frame_t      *tx_pend; // written to tx buffer, not started yet
+    cd_frame_t      *tx_act;  // started, free after tx buffer clean again
+    bool            tx_pend_urgent;
+    bool            tx_act_urgent;
     bool            tx_wait_trigger;
-    bool            tx_buf_clean_mask;
+    bool            tx_clean; // BIT_FLAG_TX_BUF_CLEAN seen, no tx_start since
+    uint8_t         int_mask; // current REG_INT_MASK
+    uint8_t         rx_ctrl; // pending bits for next REG_RX_CTRL write
+    uint8_t         tx_ctrl; // pending bits for next REG_TX_CTRL write
+
+    uint8_t         rx_drain; // frames left for current rx batch
+    uint8_t         rx_batch;
+    bool            rx_irq_off;
+    bool            rx_pause; // by cd_intf.set_rx_pause
+    uint32_t        rx_drain_time;
+    // stop rx_pending irq while the batch reach this size, the frames are
+    // drained by other irqs or by get_rx_frame after CDCTL_COALESCE_TIME,
+    // 0: disable
+    uint8_t         rx_coalesce;
+
+    // adapt REG_TX_WAIT_LEN in this range by collisions and tx queue,
+    // set before init, 0 for tx_wait_max: disable
+    uint8_t         tx_wait_min;
+    uint8_t         tx_wait_max;
+    uint32_t        tx_wait_time;
+    uint32_t        tx_wait_cd_cnt; // tx_cd_cnt + tx_error_cnt at last adapt
+    uint32_t        tx_wait_tx_cnt; // tx_done_cnt at last adapt
+
+    uint8_t         reg_cache[9]; // REG_VERSION ~ REG_DIV_HS_H
+    uint16_t        reg_dirty;    // bit n: reg_cache[n] not write yet
 
     uint8_t         buf[4];
 
+    // init state machine
+    cdctl_init_state_t init_state;
+    uint32_t        init_start;
+    uint32_t        init_time;
+    uint8_t         init_ver;
+    uint8_t         init_same_cnt;
+    uint8_t         init_filter;
+    uint32_t        init_baud_l;
+    uint32_t        init_baud_h;
+
     uint32_t        rx_cnt;
     uint32_t        tx_cnt;
     uint32_t        rx_lost_cnt;
     uint32_t        rx_error_cnt;
     uint32_t        tx_cd_cnt;
     uint32_t        tx_error_cnt;
+    uint32_t        tx_abort_cnt; // started frames requeued for urgent ones
+    uint32_t        tx_done_cnt;  // frames sent out, tx_cnt counts the queued
     uint32_t        rx_no_free_node_cnt;
+    uint16_t        free_min; // lowest free frames since init
 
     spi_t           *spi;
     gpio_t          *rst_n;
@@ -60,14 +133,19 @@ typedef struct {
 } cdctl_intf_t;
 
 
-void cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
+void cdctl_intf_setup(cdctl_intf_t *intf, list_head_t *free_head,
+        uint8_t filter, uint32_t baud_l, uint32_t baud_h,
+        spi_t *spi, gpio_t *rst_n, gpio_t *int_n);
+int cdctl_intf_init(cdctl_intf_t *intf, list_head_t *free_head,
         uint8_t filter, uint32_t baud_l, uint32_t baud_h,
         spi_t *spi, gpio_t *rst_n, gpio_t *int_n);
+int cdctl_init_routine(cdctl_intf_t *intf);
 
 cd_frame_t *cdctl_get_free_frame(cd_intf_t *cd_intf);
 cd_frame_t *cdctl_get_rx_frame(cd_intf_t *cd_intf);
 void cdctl_put_free_frame(cd_intf_t *cd_intf, cd_frame_t *frame);
 void cdctl_put_tx_frame(cd_intf_t *cd_intf, cd_frame_t *frame);
+void cdctl_put_tx_frame_urgent(cd_intf_t *cd_intf, cd_frame_t *frame);
 
 void cdctl_int_isr(cdctl_intf_t *intf);
 void cdctl_spi_isr(cdctl_intf_t *intf);
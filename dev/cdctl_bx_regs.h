@@ -30,7 +30,7 @@
 #define REG_RX_CTRL         0x0d
 #define REG_TX_CTRL         0x0e
 #define REG_RX_ADDR         0x0f
-#define REG_RX_PAGE_FLAG    0x10
+#define REG_RX_PAGE_FLAG    0x10 // bit n set: rx page n is pending
 
 
 #define BIT_SETTING_TX_PUSH_PULL    (1 << 0)
@@ -18,6 +18,12 @@ int cdnet_l1_from_frame(cdnet_intf_t *intf,
         const uint8_t *buf, cdnet_packet_t *pkt);
 int cdnet_l2_from_frame(cdnet_intf_t *intf,
         const uint8_t *buf, cdnet_packet_t *pkt);
+int cdnet_l0_to_frame_hdr(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        uint8_t *buf, int len);
+int cdnet_l1_to_frame_hdr(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        uint8_t *buf, int len);
+int cdnet_l2_to_frame_hdr(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        uint8_t *buf, int len);
 
 void cdnet_seq_init(cdnet_intf_t *intf);
 void cdnet_p0_request_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt);
@@ -41,14 +47,320 @@ void cdnet_intf_init(cdnet_intf_t *intf, list_head_t *free_head,
     intf->l0_last_port = 0;
     list_head_init(&intf->rx_head);
     list_head_init(&intf->tx_head);
+    list_head_init(&intf->tx_done_head);
+    memset(intf->pools, 0, sizeof(intf->pools));
+    list_head_init(&intf->ctrl_head);
+    intf->ctrl_mem = NULL;
+    intf->ctrl_num = 0;
+    intf->rx_paused = false;
 #endif
 
+    cdnet_stat_reset(intf);
     cdnet_seq_init(intf);
 }
 
+// carve free_head, the pools, the ctrl packets and the seq records, the list
+// heads share one cache line, a->used is the footprint afterwards,
+// return -1 if a->size is not enough, a->need tells the size required
+int cdnet_intf_init_arena(cdnet_intf_t *intf, cd_arena_t *a,
+        const cdnet_mem_cfg_t *cfg, cd_intf_t *cd_intf, cdnet_addr_t *addr)
+{
+    int i;
+    bool err = false;
+    cdnet_pool_mem_t *pool_mem[CDNET_POOL_MAX];
+
+    // cdnet_packet_alloc takes the first pool which fits
+    for (i = 1; i < CDNET_POOL_MAX; i++) {
+        if (cfg->pool_num[i] && cfg->pool_num[i - 1] &&
+                cfg->pool_dat_size[i] < cfg->pool_dat_size[i - 1]) {
+            d_error("cdnet: arena: pool_dat_size not ascending\n");
+            return -1;
+        }
+    }
+    list_head_t *heads = cd_arena_alloc(a,
+            sizeof(list_head_t) * (1 + CDNET_POOL_MAX), CD_CACHE_LINE);
+    seq_rx_rec_t *rx_recs = cd_arena_alloc(a,
+            sizeof(seq_rx_rec_t) * cfg->seq_rx_rec_num, CD_CACHE_LINE);
+    seq_tx_rec_t *tx_recs = cd_arena_alloc(a,
+            sizeof(seq_tx_rec_t) * cfg->seq_tx_rec_num, CD_CACHE_LINE);
+    uint8_t *pkt_mem = cd_arena_alloc(a,
+            sizeof(cdnet_packet_t) * cfg->pkt_num, CD_CACHE_LINE);
+    cdnet_pool_mem_t *ctrl_mem = cd_arena_alloc(a,
+            CDNET_PACKET_SIZE(CDNET_CTRL_DAT_SIZE) * cfg->ctrl_num,
+            CD_CACHE_LINE);
+
+    err = !heads || !rx_recs || !tx_recs || !pkt_mem || !ctrl_mem;
+    for (i = 0; i < CDNET_POOL_MAX; i++) {
+        pool_mem[i] = cd_arena_alloc(a, CDNET_PACKET_SIZE(
+                cfg->pool_dat_size[i]) * cfg->pool_num[i], CD_CACHE_LINE);
+        err = err || !pool_mem[i];
+    }
+    if (err) {
+        d_error("cdnet: arena: need %u, size %u\n", a->need, a->size);
+        return -1;
+    }
+
+    intf->seq_rx_rec_mem = cfg->seq_rx_rec_num ? rx_recs : NULL;
+    intf->seq_tx_rec_mem = cfg->seq_tx_rec_num ? tx_recs : NULL;
+    intf->seq_rx_rec_num = cfg->seq_rx_rec_num;
+    intf->seq_tx_rec_num = cfg->seq_tx_rec_num;
+    cdnet_intf_init(intf, heads, cd_intf, addr);
+
+    cdnet_free_fill(heads, (cdnet_packet_t *)pkt_mem, cfg->pkt_num);
+    for (i = 0; i < CDNET_POOL_MAX; i++) {
+        if (!cfg->pool_num[i])
+            continue;
+        cdnet_pool_fill(&heads[1 + i], pool_mem[i],
+                cfg->pool_dat_size[i], cfg->pool_num[i]);
+        intf->pools[i].head = &heads[1 + i];
+        intf->pools[i].dat_size = cfg->pool_dat_size[i];
+    }
+    if (cfg->ctrl_num)
+        cdnet_ctrl_fill(intf, ctrl_mem, cfg->ctrl_num);
+
+    dn_info(intf->name, "arena: %u / %u bytes\n", a->used, a->size);
+    return 0;
+}
+
 
 // helper
 
+static void cdnet_packet_init(cdnet_packet_t *pkt, uint8_t dat_size)
+{
+    pkt->_dat_size = dat_size;
+    pkt->_ref = 0;
+    pkt->seq_stream_set = false;
+    pkt->urgent = false;
+}
+
+void cdnet_pool_fill(list_head_t *head, cdnet_pool_mem_t *mem,
+        uint8_t dat_size, int num)
+{
+    for (int i = 0; i < num; i++) {
+        cdnet_packet_t *pkt = (cdnet_packet_t *)((uint8_t *)mem +
+                i * CDNET_PACKET_SIZE(dat_size));
+        cdnet_packet_init(pkt, dat_size);
+        cdnet_list_put(head, &pkt->node);
+    }
+}
+
+// full size packets for free_head, for memory not zeroed, e.g. malloc
+void cdnet_free_fill(list_head_t *head, cdnet_packet_t *pkts, int num)
+{
+    for (int i = 0; i < num; i++) {
+        cdnet_packet_init(&pkts[i], 0);
+        cdnet_list_put(head, &pkts[i].node);
+    }
+}
+
+void cdnet_stat_reset(cdnet_intf_t *intf)
+{
+    intf->free_min = 0xffff;
+    for (int i = 0; i < CDNET_POOL_MAX; i++)
+        intf->pool_min[i] = 0xffff;
+    intf->ctrl_min = 0xffff;
+    intf->rx_no_pkt_cnt = 0;
+    intf->ack_no_pkt_cnt = 0;
+    intf->p0_no_pkt_cnt = 0;
+    intf->tx_no_frame_cnt = 0;
+}
+
+#define stat_min(min, len)  do { if ((len) < (min)) (min) = (len); } while (0)
+
+// pick the smallest packet which has at least size bytes dat
+cdnet_packet_t *cdnet_packet_alloc(cdnet_intf_t *intf, int size)
+{
+    cdnet_packet_t *pkt;
+
+    for (int i = 0; i < CDNET_POOL_MAX; i++) {
+        cdnet_pool_t *pool = &intf->pools[i];
+        if (pool->head && size <= pool->dat_size && pool->head->first) {
+            pkt = cdnet_packet_get(pool->head);
+            stat_min(intf->pool_min[i], pool->head->len);
+            return pkt;
+        }
+    }
+    if (intf->free_mag)
+        pkt = cd_mag_get_entry(intf->free_mag, cdnet_packet_t);
+    else
+        pkt = cdnet_packet_get(intf->free_head);
+    stat_min(intf->free_min, cdnet_free_len(intf));
+    return pkt;
+}
+
+// storage: cdnet_pool_mem_t mem[CDNET_POOL_MEM(CDNET_CTRL_DAT_SIZE, num)],
+// call after init
+void cdnet_ctrl_fill(cdnet_intf_t *intf, cdnet_pool_mem_t *mem, int num)
+{
+    intf->ctrl_mem = (uint8_t *)mem;
+    intf->ctrl_num = num;
+    cdnet_pool_fill(&intf->ctrl_head, mem, CDNET_CTRL_DAT_SIZE, num);
+}
+
+static bool is_ctrl_pkt(const cdnet_intf_t *intf, const cdnet_packet_t *pkt)
+{
+    const uint8_t *p = (const uint8_t *)pkt;
+    return p >= intf->ctrl_mem && p < intf->ctrl_mem +
+            intf->ctrl_num * CDNET_PACKET_SIZE(CDNET_CTRL_DAT_SIZE);
+}
+
+// for port 0 traffic, the reserved packets first
+cdnet_packet_t *cdnet_ctrl_alloc(cdnet_intf_t *intf, int size)
+{
+    if (size <= CDNET_CTRL_DAT_SIZE && intf->ctrl_head.first) {
+        cdnet_packet_t *pkt = cdnet_packet_get(&intf->ctrl_head);
+        stat_min(intf->ctrl_min, intf->ctrl_head.len);
+        return pkt;
+    }
+    return cdnet_packet_alloc(intf, size);
+}
+
+// add a holder for fan-out without copy, e.g. a local handler and the tx
+// queue of a forwarding interface, each holder calls cdnet_packet_free,
+// keep it read-only while shared, only one holder may put it to a list,
+// the others use it by pointer, seq tx of a shared packet is rejected
+cdnet_packet_t *cdnet_packet_ref(cdnet_packet_t *pkt)
+{
+#ifdef CDNET_IRQ_SAFE
+    uint32_t flags;
+    local_irq_save(flags);
+#endif
+    if (pkt->_ref == 255) {
+        d_error("cdnet: too many refs\n");
+        pkt = NULL;
+    } else {
+        pkt->_ref++;
+    }
+#ifdef CDNET_IRQ_SAFE
+    local_irq_restore(flags);
+#endif
+    return pkt;
+}
+
+// return true if other holders are left
+static bool cdnet_packet_unref(cdnet_packet_t *pkt)
+{
+    bool ret = false;
+#ifdef CDNET_IRQ_SAFE
+    uint32_t flags;
+    local_irq_save(flags);
+#endif
+    if (pkt->_ref) {
+        pkt->_ref--;
+        ret = true;
+    }
+#ifdef CDNET_IRQ_SAFE
+    local_irq_restore(flags);
+#endif
+    return ret;
+}
+
+// release one holder, back to the pool after the last one
+void cdnet_packet_free(cdnet_intf_t *intf, cdnet_packet_t *pkt)
+{
+    if (cdnet_packet_unref(pkt))
+        return;
+    pkt->seq_stream_set = false;
+    pkt->urgent = false;
+    if (is_ctrl_pkt(intf, pkt)) {
+        cdnet_list_put(&intf->ctrl_head, &pkt->node);
+        return;
+    }
+    if (!pkt->_dat_size) {
+        if (intf->free_mag)
+            cd_mag_put(intf->free_mag, &pkt->node);
+        else
+            cdnet_list_put(intf->free_head, &pkt->node);
+        return;
+    }
+    for (int i = 0; i < CDNET_POOL_MAX; i++) {
+        cdnet_pool_t *pool = &intf->pools[i];
+        if (pool->head && pool->dat_size == pkt->_dat_size) {
+            cdnet_list_put(pool->head, &pkt->node);
+            return;
+        }
+    }
+    dn_error(intf->name, "free: no pool for size %d\n", pkt->_dat_size);
+}
+
+static int cdnet_to_frame_hdr(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        uint8_t *buf, int len)
+{
+    assert(!pkt->seq); // the seq engine needs pkt->dat for retransmission
+
+    if (pkt->level == CDNET_L0)
+        return cdnet_l0_to_frame_hdr(intf, pkt, buf, len);
+    if (pkt->level == CDNET_L1)
+        return cdnet_l1_to_frame_hdr(intf, pkt, buf, len);
+#ifdef CDNET_USE_L2
+    if (pkt->level == CDNET_L2)
+        return cdnet_l2_to_frame_hdr(intf, pkt, buf, len);
+#endif
+    return -1;
+}
+
+// zero-copy tx for packets without seq: the headers from pkt are encoded
+// into a free frame, write the payload to the returned place, at most
+// 253 - frame->dat[2] bytes, then call cdnet_frame_send,
+// pkt->dat is not used, the frame is not ordered with intf->tx_head
+uint8_t *cdnet_frame_prepare(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        cd_frame_t **frame)
+{
+    cd_intf_t *cd_intf = intf->cd_intf;
+    int hdr_len;
+
+    *frame = cd_intf->get_free_frame(cd_intf);
+    if (!*frame) {
+        intf->tx_no_frame_cnt++;
+        dn_warn(intf->name, "tx: no free frame\n");
+        return NULL;
+    }
+    hdr_len = cdnet_to_frame_hdr(intf, pkt, (*frame)->dat, 0);
+    if (hdr_len < 0) {
+        dn_error(intf->name, "tx: to_frame err\n");
+        cd_intf->put_free_frame(cd_intf, *frame);
+        *frame = NULL;
+        return NULL;
+    }
+    return (*frame)->dat + hdr_len;
+}
+
+int cdnet_frame_send(cdnet_intf_t *intf, cd_frame_t *frame, int len)
+{
+    cd_intf_t *cd_intf = intf->cd_intf;
+
+    if (len < 0 || frame->dat[2] + len > 253) {
+        dn_error(intf->name, "tx: frame len err: %d\n", len);
+        cd_intf->put_free_frame(cd_intf, frame);
+        return -1;
+    }
+    frame->dat[2] += len;
+    cd_intf->put_tx_frame(cd_intf, frame);
+    return 0;
+}
+
+// gather the payload regions into the frame directly, skip pkt->dat
+int cdnet_send_iov(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        const cdnet_iov_t *iov, int cnt)
+{
+    cd_frame_t *frame;
+    uint8_t *buf = cdnet_frame_prepare(intf, pkt, &frame);
+    uint8_t *buf_s = buf;
+
+    if (!buf)
+        return -1;
+    for (int i = 0; i < cnt; i++) {
+        if (buf - buf_s + iov[i].len > 253 - frame->dat[2]) {
+            dn_error(intf->name, "tx: iov too long\n");
+            intf->cd_intf->put_free_frame(intf->cd_intf, frame);
+            return -1;
+        }
+        memcpy(buf, iov[i].base, iov[i].len);
+        buf += iov[i].len;
+    }
+    return cdnet_frame_send(intf, frame, buf - buf_s);
+}
+
 void cdnet_exchg_src_dst(cdnet_intf_t *intf, cdnet_packet_t *pkt)
 {
     swap(pkt->src_mac, pkt->dst_mac);
@@ -77,6 +389,104 @@ void cdnet_fill_src_addr(cdnet_intf_t *intf, cdnet_packet_t *pkt)
 
 //
 
+// by the packets waiting in rx_head only, which the app frees without
+// waiting for the peers, the ones held by our tx are freed by the acks
+static void cdnet_rx_flow(cdnet_intf_t *intf)
+{
+    cd_intf_t *cd_intf = intf->cd_intf;
+    uint32_t len = intf->rx_head.len;
+
+    if (!intf->rx_paused && intf->rx_wm_high && len >= intf->rx_wm_high) {
+        dn_debug(intf->name, "rx: pause, rx_head %u\n", len);
+        intf->rx_paused = true;
+        if (cd_intf->set_rx_pause)
+            cd_intf->set_rx_pause(cd_intf, true);
+
+    } else if (intf->rx_paused && len <= intf->rx_wm_low) {
+        dn_debug(intf->name, "rx: resume, rx_head %u\n", len);
+        intf->rx_paused = false;
+        if (cd_intf->set_rx_pause)
+            cd_intf->set_rx_pause(cd_intf, false);
+    }
+}
+
+// port 0 of stream n use CDNET_DEF_PORT + n
+static bool is_p0_stream_port(uint16_t port)
+{
+    return port >= CDNET_DEF_PORT && port - CDNET_DEF_PORT <= 0xff &&
+            is_seq_stream_valid(port - CDNET_DEF_PORT);
+}
+
+static cdnet_rx_quota_t *rx_quota_match(cdnet_intf_t *intf,
+        const cdnet_packet_t *pkt)
+{
+    if (pkt->level == CDNET_L2)
+        return NULL;
+    for (int i = 0; i < intf->rx_quota_num; i++) {
+        cdnet_rx_quota_t *q = intf->rx_quota + i;
+        if (pkt->dst_port >= q->port_min && pkt->dst_port <= q->port_max)
+            return q;
+    }
+    return NULL;
+}
+
+// check the quota of pkt before it goes to rx_head, return false if dropped
+static bool cdnet_rx_admit(cdnet_intf_t *intf, cdnet_packet_t *pkt)
+{
+    list_node_t *pre, *cur;
+    list_node_t *old_pre = NULL, *old = NULL;
+    cdnet_rx_quota_t *q = rx_quota_match(intf, pkt);
+    int used = 0;
+
+    if (!q)
+        return true;
+    if (cdnet_free_len(intf) < q->min_free) {
+        dn_verbose(intf->name, "rx: port %d: drop, low free\n", pkt->dst_port);
+        q->drop_free++;
+        cdnet_packet_free(intf, pkt);
+        return false;
+    }
+    if (!q->max)
+        return true;
+
+#ifdef CDNET_IRQ_SAFE
+    uint32_t flags;
+    local_irq_save(flags);
+#endif
+    list_for_each(&intf->rx_head, pre, cur) {
+        cdnet_packet_t *p = list_entry(cur, cdnet_packet_t);
+        if (rx_quota_match(intf, p) != q)
+            continue;
+        used++;
+        // the seq ones are acked already, never the victim
+        if (!old && !p->seq) {
+            old_pre = pre;
+            old = cur;
+        }
+    }
+    bool over = used >= q->max;
+    if (over && old && q->policy == CDNET_RX_DROP_OLDEST && !pkt->seq)
+        list_pick(&intf->rx_head, old_pre, old);
+    else
+        old = NULL;
+#ifdef CDNET_IRQ_SAFE
+    local_irq_restore(flags);
+#endif
+
+    if (!over)
+        return true;
+    if (old) {
+        dn_verbose(intf->name, "rx: port %d: drop oldest\n", pkt->dst_port);
+        q->drop_oldest++;
+        cdnet_packet_free(intf, list_entry(old, cdnet_packet_t));
+        return true;
+    }
+    dn_verbose(intf->name, "rx: port %d: drop tail\n", pkt->dst_port);
+    q->drop_tail++;
+    cdnet_packet_free(intf, pkt);
+    return false;
+}
+
 void cdnet_rx(cdnet_intf_t *intf)
 {
     cd_frame_t *frame;
@@ -85,7 +495,14 @@ void cdnet_rx(cdnet_intf_t *intf)
     int ret_val;
 
     while (true) {
-        if (!intf->free_head->first) {
+        cdnet_rx_flow(intf);
+
+        // keep a full size one, so any frame fits,
+        // else take port 0 traffic only, by the reserved packets,
+        // during rx pause, the frames already taken by the driver are
+        // still handled, the new ones wait in the controller
+        bool ctrl_only = !cdnet_free_len(intf);
+        if (ctrl_only && !intf->ctrl_head.first) {
             dn_warn(intf->name, "rx: no free pkt\n");
             return;
         }
@@ -93,7 +510,18 @@ void cdnet_rx(cdnet_intf_t *intf)
         frame = cd_intf->get_rx_frame(cd_intf);
         if (!frame)
             return;
-        pkt = cdnet_packet_get(intf->free_head);
+        if (ctrl_only && frame->dat[2] > CDNET_CTRL_DAT_SIZE) {
+            intf->rx_no_pkt_cnt++;
+            dn_warn(intf->name, "rx: no free pkt, drop\n");
+            cd_intf->put_free_frame(cd_intf, frame);
+            continue;
+        }
+        // the payload is never longer than the frame
+        if (ctrl_only) {
+            pkt = cdnet_packet_get(&intf->ctrl_head);
+            stat_min(intf->ctrl_min, intf->ctrl_head.len);
+        } else
+            pkt = cdnet_packet_alloc(intf, frame->dat[2]);
 
         if ((frame->dat[3] & 0xc0) == 0xc0) {
 #ifdef CDNET_USE_L2
@@ -119,26 +547,43 @@ void cdnet_rx(cdnet_intf_t *intf)
 
         if (ret_val != 0) {
             dn_error(intf->name, "rx: from_frame err\n");
-            cdnet_list_put(intf->free_head, &pkt->node);
+            cdnet_packet_free(intf, pkt);
             continue;
         }
         if (pkt->multi & CDNET_MULTI_CAST) {
             dn_error(intf->name, "rx: not support multicast yet\n");
-            cdnet_list_put(intf->free_head, &pkt->node);
+            cdnet_packet_free(intf, pkt);
             continue;
         }
 
         if (pkt->level != CDNET_L2) {
-            if (pkt->dst_port == 0 && pkt->src_port >= CDNET_DEF_PORT) {
+            if (pkt->dst_port == 0 && is_p0_stream_port(pkt->src_port)) {
+                pkt->seq_stream = pkt->src_port - CDNET_DEF_PORT;
                 cdnet_p0_request_handle(intf, pkt);
                 continue;
             }
-            if (pkt->src_port == 0 && pkt->dst_port == CDNET_DEF_PORT) {
+            if (pkt->src_port == 0 && is_p0_stream_port(pkt->dst_port)) {
+                pkt->seq_stream = pkt->dst_port - CDNET_DEF_PORT;
                 cdnet_p0_reply_handle(intf, pkt);
                 continue;
             }
         }
+        if (ctrl_only) {
+            intf->rx_no_pkt_cnt++;
+            dn_warn(intf->name, "rx: no free pkt, drop data\n");
+            cdnet_packet_free(intf, pkt);
+            continue;
+        }
+        // before the seq handle, so a dropped seq pkt is not acked
+        if (!cdnet_rx_admit(intf, pkt))
+            continue;
         if (pkt->seq) {
+            pkt->seq_stream = intf->seq_stream ? intf->seq_stream(pkt) : 0;
+            if (!is_seq_stream_valid(pkt->seq_stream)) {
+                dn_error(intf->name, "rx: invalid stream %d\n", pkt->seq_stream);
+                cdnet_packet_free(intf, pkt);
+                continue;
+            }
             cdnet_seq_rx_handle(intf, pkt);
             continue;
         }
@@ -151,4 +596,10 @@ void cdnet_rx(cdnet_intf_t *intf)
 void cdnet_tx(cdnet_intf_t *intf)
 {
     cdnet_seq_tx_routine(intf);
+
+    if (intf->tx_done_head.first) {
+        intf->tx_done(intf, &intf->tx_done_head);
+        while (intf->tx_done_head.first)
+            cdnet_packet_free(intf, cdnet_packet_get(&intf->tx_done_head));
+    }
 }
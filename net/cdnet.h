@@ -13,6 +13,8 @@
 #include "cd_utils.h"
 #include "arch_wrapper.h"
 #include "cd_list.h"
+#include "cd_arena.h"
+#include "cd_mag.h"
 
 #ifndef CDNET_DEF_PORT
 #define CDNET_DEF_PORT      0xcdcd
@@ -22,11 +24,18 @@
 #define CDNET_DAT_SIZE      252
 #endif
 
+#ifndef CDNET_POOL_MAX
+#define CDNET_POOL_MAX      2       // pools of smaller packets, see cdnet_pool_t
+#endif
+#ifndef CDNET_CTRL_DAT_SIZE
+#define CDNET_CTRL_DAT_SIZE 12      // reserved port 0 packets, see cdnet_ctrl_fill
+#endif
+
 #ifndef SEQ_RX_REC_MAX
-#define SEQ_RX_REC_MAX      3
+#define SEQ_RX_REC_MAX      3       // can be 0 with seq_rx_rec_mem
 #endif
 #ifndef SEQ_TX_REC_MAX
-#define SEQ_TX_REC_MAX      3
+#define SEQ_TX_REC_MAX      3       // can be 0 with seq_tx_rec_mem
 #endif
 #ifndef SEQ_TX_ACK_CNT
 #define SEQ_TX_ACK_CNT      3
@@ -37,6 +46,13 @@
 #ifndef SEQ_TX_PEND_MAX
 #define SEQ_TX_PEND_MAX     6
 #endif
+#ifndef SEQ_TX_PEND_MAX_EXT
+#define SEQ_TX_PEND_MAX_EXT 64      // for peers using 15 bits seq_num
+#endif
+
+#if SEQ_TX_PEND_MAX >= 64 || SEQ_TX_PEND_MAX_EXT >= 16384
+#error "SEQ_TX_PEND_MAX must be less than half of the seq_num space"
+#endif
 
 #ifndef SEQ_TIMEOUT
 #define SEQ_TIMEOUT         (5000 / SYSTICK_US_DIV) // 5 ms
@@ -53,13 +69,13 @@
 #endif
 
 
-typedef enum {
+typedef enum __attribute__((packed)) {
     CDNET_L0 = 0,
     CDNET_L1,
     CDNET_L2
 } cdnet_level_t;
 
-typedef enum {
+typedef enum __attribute__((packed)) {
     CDNET_MULTI_NONE = 0,
     CDNET_MULTI_CAST,
     CDNET_MULTI_NET,
@@ -67,13 +83,25 @@ typedef enum {
 
 } cdnet_multi_t;
 
-typedef enum {
+typedef enum __attribute__((packed)) {
     CDNET_FRAG_NONE = 0,
     CDNET_FRAG_FIRST,
     CDNET_FRAG_MORE,
     CDNET_FRAG_LAST
 } cdnet_frag_t;
 
+typedef enum __attribute__((packed)) {
+    CDNET_TX_DELIVERED = 0, // got ack
+    CDNET_TX_FAILED,        // sent, but not acked before reach retry_max
+    CDNET_TX_EXPIRED        // dropped before sent out
+} cdnet_tx_ret_t;
+
+typedef enum __attribute__((packed)) {
+    CDNET_RX_DROP_TAIL = 0, // drop the new packet
+    CDNET_RX_DROP_OLDEST    // drop the oldest queued non-seq one of the same
+                            // quota, else drop the new packet
+} cdnet_rx_drop_t;
+
 #define HDR_L1_L2       (1 << 7)
 #define HDR_L2          (1 << 6)
 
@@ -81,6 +109,20 @@ typedef enum {
 #define HDR_L0_SHARE    (1 << 5)
 
 #define HDR_L1_L2_SEQ   (1 << 3)
+// together with HDR_L1_L2_SEQ: 2 bytes SEQ_NUM field,
+// sequenced multicast is not supported, so L1 reuses the multicast bit
+#define HDR_L1_SEQ_EXT  (1 << 4)
+#define HDR_L2_SEQ_EXT  (1 << 2)
+
+#define SEQ_NUM_INVALID 0x8000 // no record, need set_seq
+
+// unreliable-sequenced stream: no set_seq, no ack and no retransmission,
+// the receiver drops late packets and counts the gaps
+#define SEQ_STREAM_UNREL    0x80
+
+#ifndef SEQ_STREAM_MAX
+#define SEQ_STREAM_MAX      4 // streams per peer, reliable and unreliable each
+#endif
 
 #define ERR_ASSERT      -1
 
@@ -93,12 +135,23 @@ typedef struct {
     uint8_t     dat[260]; // max size for cdbus through uart
 } cd_frame_t;
 
+// storage for a frame with only dat_len bytes of dat[], e.g. in cd_ring_t
+#define CD_FRAME_SIZE(dat_len)  (offsetof(cd_frame_t, dat) + (dat_len))
+
+typedef enum {
+    CD_MODE_BUS = 0,    // arbitration at low baud rate
+    CD_MODE_P2P         // two nodes only, whole frame at high baud rate
+} cd_mode_t;
+
 typedef struct cd_intf {
 
     cd_frame_t *(* get_free_frame)(struct cd_intf *cd_intf);
     cd_frame_t *(* get_rx_frame)(struct cd_intf *cd_intf);
     void (* put_free_frame)(struct cd_intf *cd_intf, cd_frame_t *frame);
     void (* put_tx_frame)(struct cd_intf *cd_intf, cd_frame_t *frame);
+    // send before all queued frames, a frame loaded into the controller
+    // is requeued, a started one may be sent twice, NULL if not supported
+    void (* put_tx_frame_urgent)(struct cd_intf *cd_intf, cd_frame_t *frame);
 
     // cdbus has two baud rates
     void  (* set_baud_rate)(struct cd_intf *intf, uint32_t, uint32_t);
@@ -111,6 +164,13 @@ typedef struct cd_intf {
     void    (* set_tx_wait)(struct cd_intf *intf, uint8_t len);
     uint8_t (* get_tx_wait)(struct cd_intf *intf);
 
+    void      (* set_mode)(struct cd_intf *intf, cd_mode_t mode);
+    cd_mode_t (* get_mode)(struct cd_intf *intf);
+
+    // stop taking frames from the controller, they wait there until resume,
+    // NULL if not supported
+    void    (* set_rx_pause)(struct cd_intf *intf, bool pause);
+
     void    (* flush)(struct cd_intf *intf);
 } cd_intf_t;
 
@@ -120,18 +180,26 @@ typedef struct{
     uint8_t     mac; // mac id
 } cdnet_addr_t;
 
+// 1 byte enums and grouped fields to keep the header small
 typedef struct {
     list_node_t     node;
+    uint32_t        _send_time;
+    uint16_t        _seq_num;
 
     cdnet_level_t   level;
+    cdnet_multi_t   multi;
 
     bool            seq; // enable sequence
+    // use seq_stream instead of intf->seq_stream for tx, cleared by free
+    bool            seq_stream_set;
+    // tx before the queued frames by put_tx_frame_urgent if supported,
+    // not for seq packets, cleared by free
+    bool            urgent;
+    uint8_t         seq_stream; // set by cdnet_tx and cdnet_rx if not set
     // set by cdnet_tx:
     bool            _req_ack;
-    uint8_t         _seq_num;
-    uint32_t        _send_time;
-
-    cdnet_multi_t   multi;
+    bool            _seq_ext; // 2 bytes SEQ_NUM field
+    cdnet_tx_ret_t  _tx_ret; // for tx_done callback
 
     // local send and receive addresses
     uint8_t         src_mac;
@@ -146,6 +214,7 @@ typedef struct {
 #define dst_addr        __dst_u.__dst_addr
 #define multicast_id    __dst_u.__multicast_id
 
+    // fields before src_port are copied for the seq ack reply
     uint16_t        src_port;
     uint16_t        dst_port;
 
@@ -153,55 +222,208 @@ typedef struct {
     cdnet_frag_t    frag;
     uint8_t         l2_flag;
 
-    int             len;
+    uint8_t         _dat_size; // 0: CDNET_DAT_SIZE, else from cdnet_pool_t
+    uint8_t         _ref;      // extra holders, see cdnet_packet_ref
+    int16_t         len;
     uint8_t         dat[CDNET_DAT_SIZE];
 } cdnet_packet_t;
 
+// packets with smaller dat[], e.g. for acks and short commands
+// storage: cdnet_pool_mem_t mem[CDNET_POOL_MEM(dat_size, num)], fill by
+// cdnet_pool_fill, free these packets by cdnet_packet_free only
+typedef struct {
+    list_head_t     *head;
+    uint8_t         dat_size; // >= 4 for port 0 replies
+} cdnet_pool_t;
+
+// pool storage unit, keeps the packets aligned, e.g. 8 bytes on 64-bit pc
+typedef struct {
+    _Alignas(cdnet_packet_t) uint8_t _b[_Alignof(cdnet_packet_t)];
+} cdnet_pool_mem_t;
+
+#define CDNET_PACKET_SIZE(dat_size) \
+    ((offsetof(cdnet_packet_t, dat) + (dat_size) + \
+            sizeof(cdnet_pool_mem_t) - 1) / \
+            sizeof(cdnet_pool_mem_t) * sizeof(cdnet_pool_mem_t))
+#define CDNET_POOL_MEM(dat_size, num) \
+    (CDNET_PACKET_SIZE(dat_size) * (num) / sizeof(cdnet_pool_mem_t))
+
+static inline int cdnet_dat_size(const cdnet_packet_t *pkt)
+{
+    return pkt->_dat_size ? pkt->_dat_size : CDNET_DAT_SIZE;
+}
+
+// limit the packets of a dst_port range queued in rx_head, the first match
+// is used, ports not covered are not limited, L2 packets are not checked
+typedef struct {
+    uint16_t        port_min;
+    uint16_t        port_max;
+    uint8_t         max;      // queued in rx_head, 0: no limit
+    uint8_t         min_free; // keep free_head packets for the other ports
+    cdnet_rx_drop_t policy;   // seq packets always drop tail, then resent
+
+    // drop counters by reason
+    uint32_t        drop_tail;
+    uint32_t        drop_oldest;
+    uint32_t        drop_free;  // below min_free
+} cdnet_rx_quota_t;
+
+// payload region for cdnet_send_iov, owned by the caller
+typedef struct {
+    const void      *base;
+    int             len;
+} cdnet_iov_t;
+
 
 typedef struct {
     list_node_t     node;
     cdnet_addr_t    addr; // net = 255: link local; mac = 255: not used
-    uint8_t         seq_num;
+    uint8_t         stream;
+    uint16_t        seq_num;
+    bool            seq_ext; // 15 bits seq_num
+    bool            epoch_ret; // the sender asked for the epoch in returns
+
+    // for SEQ_STREAM_UNREL only
+    uint32_t        lost_cnt;
+    uint32_t        late_cnt;
 } seq_rx_rec_t;
 
 typedef struct {
     list_node_t     node;
     cdnet_addr_t    addr; // net = 255: link local; mac = 255: not used
-    uint8_t         seq_num;
+    uint8_t         stream;
+    uint16_t        seq_num;
+    bool            seq_ext; // 15 bits seq_num
 
     // for tx only
     list_head_t     wait_head;
     list_head_t     pend_head;
     uint8_t         send_cnt; // send ack for each SEQ_TX_ACK_CNT
     uint8_t         p0_retry_cnt;
+    uint8_t         peer_epoch; // from the set_seq return
+    bool            peer_epoch_valid;
     cdnet_packet_t  *p0_req;
 } seq_tx_rec_t;
 
-typedef struct {
+typedef struct cdnet_intf {
     const char      *name;
     cdnet_addr_t    addr; // interface address
     uint8_t         l0_last_port; // don't override before receive the reply
+    uint8_t         epoch; // boot id, e.g. random or boot count, set by user
 
+    // full size packets, zero init (e.g. static) or put by cdnet_free_fill,
+    // a garbage _dat_size or _ref breaks cdnet_packet_free
     list_head_t     *free_head;
+    // optional, set before init: cache of free_head for the context calling
+    // cdnet_rx, cdnet_tx and cdnet_packet_free, other contexts can have
+    // their own cd_mag_t or use free_head directly
+    cd_mag_t        *free_mag;
+    // optional, set after init, in ascending dat_size order, the first one
+    // which fits is taken
+    cdnet_pool_t    pools[CDNET_POOL_MAX];
+    // reserved for port 0 traffic: acks, set_seq and check_seq, so the seq
+    // protocol keeps going when free_head and pools run out
+    list_head_t     ctrl_head;
+    uint8_t         *ctrl_mem;
+    uint16_t        ctrl_num;
+
+    // rx backpressure by rx_head->len, set before init, rx_wm_high 0: disable,
+    // from rx_wm_high: pause the cd_intf rx, the frames already taken by the
+    // driver (port 0 or data) are still handled, resume at rx_wm_low,
+    // the app must drain rx_head without waiting for its own tx
+    uint8_t         rx_wm_low;
+    uint8_t         rx_wm_high;
+    bool            rx_paused;
+    // optional, set before init
+    cdnet_rx_quota_t *rx_quota;
+    uint8_t         rx_quota_num;
     list_head_t     rx_head;
     list_head_t     tx_head;
+    list_head_t     tx_done_head;
+
+    // report finished sequenced packets at the end of each cdnet_tx,
+    // pkts left in done_head are freed after return, free directly if NULL,
+    // the SEQ_STREAM_UNREL ones are not acked, only reported if not sent
+    void            (* tx_done)(struct cdnet_intf *intf,
+                            list_head_t *done_head);
 
     cd_intf_t       *cd_intf;
 
+    // map packet to an independent seq stream of the peer, e.g. by dst_port,
+    // must be the same mapping for both sides, use stream 0 if NULL,
+    // return with SEQ_STREAM_UNREL for unreliable-sequenced delivery,
+    // not called for tx packets with seq_stream_set
+    uint8_t         (* seq_stream)(const cdnet_packet_t *pkt);
+
     seq_rx_rec_t    seq_rx_rec_alloc[SEQ_RX_REC_MAX];
     seq_tx_rec_t    seq_tx_rec_alloc[SEQ_TX_REC_MAX];
+    // optional, set before init to use these records instead of *_rec_alloc
+    seq_rx_rec_t    *seq_rx_rec_mem;
+    seq_tx_rec_t    *seq_tx_rec_mem;
+    uint8_t         seq_rx_rec_num;
+    uint8_t         seq_tx_rec_num;
     list_head_t     seq_rx_head;
     list_head_t     seq_tx_head;
     list_head_t     seq_tx_direct_head;
+
+    // for sizing the memory: the lowest free counts since the last
+    // cdnet_stat_reset, i.e. the high-water marks of use, and the
+    // allocation failures by call site
+    uint16_t        free_min;
+    uint16_t        pool_min[CDNET_POOL_MAX];
+    uint16_t        ctrl_min;
+    uint32_t        rx_no_pkt_cnt;  // cdnet_rx: frames dropped
+    uint32_t        ack_no_pkt_cnt; // seq acks not sent
+    uint32_t        p0_no_pkt_cnt;  // set_seq and check_seq delayed
+    uint32_t        tx_no_frame_cnt;
 } cdnet_intf_t;
 
+// free packets of free_head, including the ones cached by free_mag
+static inline uint32_t cdnet_free_len(const cdnet_intf_t *intf)
+{
+    return intf->free_mag ? cd_mag_len(intf->free_mag) : intf->free_head->len;
+}
+
+// runtime memory config for cdnet_intf_init_arena
+typedef struct {
+    uint16_t        pkt_num;    // full size packets for free_head
+    uint16_t        pool_num[CDNET_POOL_MAX];
+    uint8_t         pool_dat_size[CDNET_POOL_MAX]; // ascending
+    uint8_t         seq_rx_rec_num; // 0: use seq_rx_rec_alloc
+    uint8_t         seq_tx_rec_num; // 0: use seq_tx_rec_alloc
+    uint16_t        ctrl_num;       // reserved port 0 packets
+} cdnet_mem_cfg_t;
+
 
 void cdnet_intf_init(cdnet_intf_t *intf, list_head_t *free_head,
     cd_intf_t *cd_intf, cdnet_addr_t *addr);
+int cdnet_intf_init_arena(cdnet_intf_t *intf, cd_arena_t *a,
+    const cdnet_mem_cfg_t *cfg, cd_intf_t *cd_intf, cdnet_addr_t *addr);
 
 
 // helper
 
+void cdnet_pool_fill(list_head_t *head, cdnet_pool_mem_t *mem,
+        uint8_t dat_size, int num);
+void cdnet_free_fill(list_head_t *head, cdnet_packet_t *pkts, int num);
+void cdnet_stat_reset(cdnet_intf_t *intf);
+cdnet_packet_t *cdnet_packet_alloc(cdnet_intf_t *intf, int size);
+void cdnet_ctrl_fill(cdnet_intf_t *intf, cdnet_pool_mem_t *mem, int num);
+cdnet_packet_t *cdnet_ctrl_alloc(cdnet_intf_t *intf, int size);
+void cdnet_packet_free(cdnet_intf_t *intf, cdnet_packet_t *pkt);
+cdnet_packet_t *cdnet_packet_ref(cdnet_packet_t *pkt);
+
+static inline bool cdnet_packet_shared(const cdnet_packet_t *pkt)
+{
+    return pkt->_ref != 0;
+}
+
+uint8_t *cdnet_frame_prepare(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        cd_frame_t **frame);
+int cdnet_frame_send(cdnet_intf_t *intf, cd_frame_t *frame, int len);
+int cdnet_send_iov(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        const cdnet_iov_t *iov, int cnt);
+
 void cdnet_exchg_src_dst(cdnet_intf_t *intf, cdnet_packet_t *pkt);
 void cdnet_fill_src_addr(cdnet_intf_t *intf, cdnet_packet_t *pkt);
 
@@ -213,4 +435,9 @@ static inline bool is_addr_equal(const cdnet_addr_t *a, const cdnet_addr_t *b)
     return a->mac == b->mac && a->net == b->net;
 }
 
+static inline bool is_seq_stream_valid(uint8_t stream)
+{
+    return (stream & ~SEQ_STREAM_UNREL) < SEQ_STREAM_MAX;
+}
+
 #endif
@@ -24,7 +24,10 @@ int cdnet_l1_to_l0_test(cdnet_packet_t *pkt)
 }
 
 
-int cdnet_l0_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
+// write the frame header and the cdnet header for len bytes payload,
+// return the size of them, the reply never shares the first byte here
+int cdnet_l0_to_frame_hdr(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        uint8_t *buf, int len)
 {
     uint8_t *buf_s = buf;
 
@@ -41,17 +44,32 @@ int cdnet_l0_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
         intf->l0_last_port = pkt->dst_port;
         *buf++ = pkt->dst_port; // hdr
     } else { // out reply
-        if (pkt->len >= 1 && pkt->dat[0] <= 31) {
-            // share first byte
-            pkt->dat[0] |= HDR_L0_REPLY | HDR_L0_SHARE;
-        } else {
-            *buf++ = HDR_L0_REPLY; // hdr
-        }
+        *buf++ = HDR_L0_REPLY; // hdr
+    }
+
+    assert(buf - buf_s + len <= 256);
+    *(buf_s + 2) = buf - buf_s + len - 3;
+    return buf - buf_s;
+}
+
+int cdnet_l0_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
+{
+    int hdr_len;
+
+    if (pkt->src_port != CDNET_DEF_PORT && pkt->len >= 1 && pkt->dat[0] <= 31) {
+        // out reply, share first byte
+        hdr_len = cdnet_l0_to_frame_hdr(intf, pkt, buf, pkt->len - 1);
+        if (hdr_len < 0)
+            return hdr_len;
+        buf[hdr_len - 1] |= HDR_L0_SHARE | pkt->dat[0];
+        memcpy(buf + hdr_len, pkt->dat + 1, pkt->len - 1);
+        return 0;
     }
 
-    assert(buf - buf_s + pkt->len <= 256);
-    *(buf_s + 2) = buf - buf_s + pkt->len - 3;
-    memcpy(buf, pkt->dat, pkt->len);
+    hdr_len = cdnet_l0_to_frame_hdr(intf, pkt, buf, pkt->len);
+    if (hdr_len < 0)
+        return hdr_len;
+    memcpy(buf + hdr_len, pkt->dat, pkt->len);
     return 0;
 }
 
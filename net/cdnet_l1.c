@@ -63,7 +63,10 @@ static int cal_port_val(uint16_t src, uint16_t dst,
 }
 
 
-int cdnet_l1_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
+// write the frame header and the cdnet header for len bytes payload,
+// return the size of them
+int cdnet_l1_to_frame_hdr(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        uint8_t *buf, int len)
 {
     int ret;
     uint8_t src_port_size;
@@ -94,9 +97,14 @@ int cdnet_l1_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
         break;
     }
 
-    if (pkt->seq) {
+    if (pkt->seq && pkt->_seq_ext) {
+        assert(!(pkt->multi & CDNET_MULTI_CAST));
+        *hdr |= HDR_L1_L2_SEQ | HDR_L1_SEQ_EXT;
+        *buf++ = pkt->_seq_num & 0xff;
+        *buf++ = (pkt->_seq_num >> 8) | (pkt->_req_ack << 7);
+    } else if (pkt->seq) {
         *hdr |= HDR_L1_L2_SEQ;
-        *buf++ = pkt->_seq_num | (pkt->_req_ack << 7);
+        *buf++ = (pkt->_seq_num & 0x7f) | (pkt->_req_ack << 7);
     }
 
     ret = cal_port_val(pkt->src_port, pkt->dst_port,
@@ -112,9 +120,17 @@ int cdnet_l1_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
     if (dst_port_size == 2)
         *buf++ = pkt->dst_port >> 8;
 
-    assert(buf - buf_s + pkt->len <= 256);
-    *(buf_s + 2) = buf - buf_s + pkt->len - 3;
-    memcpy(buf, pkt->dat, pkt->len);
+    assert(buf - buf_s + len <= 256);
+    *(buf_s + 2) = buf - buf_s + len - 3;
+    return buf - buf_s;
+}
+
+int cdnet_l1_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
+{
+    int hdr_len = cdnet_l1_to_frame_hdr(intf, pkt, buf, pkt->len);
+    if (hdr_len < 0)
+        return hdr_len;
+    memcpy(buf + hdr_len, pkt->dat, pkt->len);
     return 0;
 }
 
@@ -139,7 +155,8 @@ int cdnet_l1_from_frame(cdnet_intf_t *intf,
     buf++; // skip hdr
 
     pkt->seq = !!(*hdr & HDR_L1_L2_SEQ);
-    pkt->multi = (*hdr >> 4) & 3;
+    pkt->_seq_ext = pkt->seq && (*hdr & HDR_L1_SEQ_EXT);
+    pkt->multi = (*hdr >> 4) & (pkt->_seq_ext ? 2 : 3);
 
     switch (pkt->multi) {
     case CDNET_MULTI_CAST_NET:
@@ -155,7 +172,11 @@ int cdnet_l1_from_frame(cdnet_intf_t *intf,
         break;
     }
 
-    if (pkt->seq) {
+    if (pkt->_seq_ext) {
+        pkt->_seq_num = *buf++;
+        pkt->_seq_num |= (*buf & 0x7f) << 8;
+        pkt->_req_ack = !!(*buf++ & 0x80);
+    } else if (pkt->seq) {
         pkt->_seq_num = *buf++;
         pkt->_req_ack = !!(pkt->_seq_num & 0x80);
         pkt->_seq_num &= 0x7f;
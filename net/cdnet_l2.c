@@ -17,7 +17,11 @@
 #define assert(expr) { if (!(expr)) return ERR_ASSERT; }
 
 
-int cdnet_l2_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
+
+// write the frame header and the cdnet header for len bytes payload,
+// return the size of them
+int cdnet_l2_to_frame_hdr(cdnet_intf_t *intf, cdnet_packet_t *pkt,
+        uint8_t *buf, int len)
 {
     uint8_t *buf_s = buf;
     uint8_t *hdr = buf + 3;
@@ -37,20 +41,35 @@ int cdnet_l2_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
         *hdr |= pkt->frag << 4;
     }
 
-    if (pkt->seq) {
+    if (pkt->seq && pkt->_seq_ext) {
+        // user flag is [1:0] only
+        assert(!(pkt->l2_flag & HDR_L2_SEQ_EXT));
+        *hdr |= HDR_L1_L2_SEQ | HDR_L2_SEQ_EXT;
+        *buf++ = pkt->_seq_num & 0xff;
+        *buf++ = (pkt->_seq_num >> 8) | (pkt->_req_ack << 7);
+    } else if (pkt->seq) {
         *hdr |= HDR_L1_L2_SEQ;
-        *buf++ = pkt->_seq_num | (pkt->_req_ack << 7);
+        *buf++ = (pkt->_seq_num & 0x7f) | (pkt->_req_ack << 7);
     }
 
-    assert(buf - buf_s + pkt->len <= 256);
-    *(buf_s + 2) = buf - buf_s + pkt->len - 3;
-    memcpy(buf, pkt->dat, pkt->len);
+    assert(buf - buf_s + len <= 256);
+    *(buf_s + 2) = buf - buf_s + len - 3;
+    return buf - buf_s;
+}
+
+int cdnet_l2_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf)
+{
+    int hdr_len = cdnet_l2_to_frame_hdr(intf, pkt, buf, pkt->len);
+    if (hdr_len < 0)
+        return hdr_len;
+    memcpy(buf + hdr_len, pkt->dat, pkt->len);
     return 0;
 }
 
 int cdnet_l2_from_frame(cdnet_intf_t *intf,
         const uint8_t *buf, cdnet_packet_t *pkt)
 {
+    const uint8_t *buf_s = buf;
     const uint8_t *hdr = buf + 3;
     uint8_t tmp_len;
 
@@ -70,13 +89,19 @@ int cdnet_l2_from_frame(cdnet_intf_t *intf,
         pkt->frag = CDNET_FRAG_NONE;
     }
 
-    if (pkt->seq) {
+    pkt->_seq_ext = pkt->seq && (*hdr & HDR_L2_SEQ_EXT);
+    if (pkt->_seq_ext) {
+        pkt->l2_flag &= ~HDR_L2_SEQ_EXT;
+        pkt->_seq_num = *buf++;
+        pkt->_seq_num |= (*buf & 0x7f) << 8;
+        pkt->_req_ack = !!(*buf++ & 0x80);
+    } else if (pkt->seq) {
         pkt->_seq_num = *buf++;
         pkt->_req_ack = !!(pkt->_seq_num & 0x80);
         pkt->_seq_num &= 0x7f;
     }
 
-    pkt->len = tmp_len - (pkt->seq ? 2 : 1);
+    pkt->len = tmp_len - (buf - buf_s - 3);
     assert(pkt->len >= 0);
     memcpy(pkt->dat, buf, pkt->len);
     return 0;
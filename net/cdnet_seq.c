@@ -16,10 +16,28 @@ int cdnet_l0_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf);
 int cdnet_l1_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf);
 int cdnet_l2_to_frame(cdnet_intf_t *intf, cdnet_packet_t *pkt, uint8_t *buf);
 
+static inline uint16_t seq_num_next(uint16_t seq_num, bool ext)
+{
+    return (seq_num + 1) & (ext ? 0x7fff : 0x7f);
+}
+
 
 void cdnet_seq_init(cdnet_intf_t *intf)
 {
     int i;
+    seq_rx_rec_t *rx_recs = intf->seq_rx_rec_mem;
+    seq_tx_rec_t *tx_recs = intf->seq_tx_rec_mem;
+    int rx_num = intf->seq_rx_rec_num;
+    int tx_num = intf->seq_tx_rec_num;
+
+    if (!rx_recs) {
+        rx_recs = intf->seq_rx_rec_alloc;
+        rx_num = SEQ_RX_REC_MAX;
+    }
+    if (!tx_recs) {
+        tx_recs = intf->seq_tx_rec_alloc;
+        tx_num = SEQ_TX_REC_MAX;
+    }
 
 #ifdef USE_DYNAMIC_INIT
     list_head_init(&intf->seq_rx_head);
@@ -27,21 +45,24 @@ void cdnet_seq_init(cdnet_intf_t *intf)
     list_head_init(&intf->seq_tx_direct_head);
 #endif
 
-    for (i = 0; i < SEQ_RX_REC_MAX; i++) {
-        list_node_t *node = &intf->seq_rx_rec_alloc[i].node;
+    for (i = 0; i < rx_num; i++) {
+        list_node_t *node = &rx_recs[i].node;
         seq_rx_rec_t *rec = list_entry(node, seq_rx_rec_t);
         rec->addr.net = 255;
         rec->addr.mac = 255;
-        rec->seq_num = 0x80;
+        rec->seq_num = SEQ_NUM_INVALID;
+        rec->seq_ext = false;
+        rec->epoch_ret = false;
         list_put(&intf->seq_rx_head, node);
     }
 
-    for (i = 0; i < SEQ_TX_REC_MAX; i++) {
-        list_node_t *node = &intf->seq_tx_rec_alloc[i].node;
+    for (i = 0; i < tx_num; i++) {
+        list_node_t *node = &tx_recs[i].node;
         seq_tx_rec_t *rec = list_entry(node, seq_tx_rec_t);
         rec->addr.net = 255;
         rec->addr.mac = 255;
-        rec->seq_num = 0x80;
+        rec->seq_num = SEQ_NUM_INVALID;
+        rec->seq_ext = false;
 #ifdef USE_DYNAMIC_INIT
         list_head_init(&rec->wait_head);
         list_head_init(&rec->pend_head);
@@ -54,7 +75,7 @@ void cdnet_seq_init(cdnet_intf_t *intf)
 }
 
 
-static bool is_rx_rec_match(const seq_rx_rec_t *rec, const cdnet_packet_t *pkt)
+static bool is_rx_rec_peer(const seq_rx_rec_t *rec, const cdnet_packet_t *pkt)
 {
     if (pkt->multi >= CDNET_MULTI_NET) {
         if (is_addr_equal(&pkt->src_addr, &rec->addr))
@@ -65,9 +86,15 @@ static bool is_rx_rec_match(const seq_rx_rec_t *rec, const cdnet_packet_t *pkt)
     }
     return false;
 }
+static bool is_rx_rec_match(const seq_rx_rec_t *rec, const cdnet_packet_t *pkt)
+{
+    return rec->stream == pkt->seq_stream && is_rx_rec_peer(rec, pkt);
+}
 static bool is_tx_rec_match_input(const seq_tx_rec_t *rec,
         const cdnet_packet_t *pkt)
 {
+    if (rec->stream != pkt->seq_stream)
+        return false;
     if (pkt->multi >= CDNET_MULTI_NET) {
         if (is_addr_equal(&pkt->src_addr, &rec->addr))
             return true;
@@ -79,6 +106,8 @@ static bool is_tx_rec_match_input(const seq_tx_rec_t *rec,
 }
 static bool is_tx_rec_match(const seq_tx_rec_t *rec, const cdnet_packet_t *pkt)
 {
+    if (rec->stream != pkt->seq_stream)
+        return false;
     if (pkt->multi >= CDNET_MULTI_NET) {
         if (is_addr_equal(&pkt->dst_addr, &rec->addr))
             return true;
@@ -88,6 +117,64 @@ static bool is_tx_rec_match(const seq_tx_rec_t *rec, const cdnet_packet_t *pkt)
     }
     return false;
 }
+#ifdef CDNET_USE_SEQ_EXT
+// another stream of the same peer which has finished the set_seq
+static seq_tx_rec_t *tx_rec_sibling(cdnet_intf_t *intf, seq_tx_rec_t *rec)
+{
+    for (list_node_t *cur = intf->seq_tx_head.first; cur; cur = cur->next) {
+        seq_tx_rec_t *r = list_entry(cur, seq_tx_rec_t);
+        if (r != rec && is_addr_equal(&r->addr, &rec->addr) &&
+                !(r->stream & SEQ_STREAM_UNREL) &&
+                !(r->seq_num & SEQ_NUM_INVALID) && !r->p0_req)
+            return r;
+    }
+    return NULL;
+}
+#endif
+
+static seq_rx_rec_t *rx_rec_pick(cdnet_intf_t *intf, const cdnet_packet_t *pkt)
+{
+    seq_rx_rec_t *r;
+    r = list_entry(list_get_last(&intf->seq_rx_head), seq_rx_rec_t);
+    if (pkt->multi == CDNET_MULTI_NET) {
+        r->addr = pkt->src_addr;
+    } else {
+        r->addr.mac = pkt->src_mac;
+        r->addr.net = 255;
+    }
+    r->stream = pkt->seq_stream;
+    r->epoch_ret = false;
+    r->lost_cnt = 0;
+    r->late_cnt = 0;
+    list_put_begin(&intf->seq_rx_head, &r->node);
+    return r;
+}
+
+// release a packet of wait_head or pend_head
+static void seq_tx_finish(cdnet_intf_t *intf, list_node_t *node,
+        cdnet_tx_ret_t ret)
+{
+    cdnet_packet_t *pkt = list_entry(node, cdnet_packet_t);
+    if (!intf->tx_done || !pkt->seq) {
+        cdnet_packet_free(intf, pkt);
+        return;
+    }
+    pkt->_tx_ret = ret;
+    list_put(&intf->tx_done_head, node);
+}
+
+static void seq_ack_fill(const seq_rx_rec_t *rec, cdnet_packet_t *p)
+{
+    if (rec->seq_ext) {
+        p->len = 2;
+        p->dat[0] = rec->seq_num & 0xff;
+        p->dat[1] = (rec->seq_num >> 8) | 0x80;
+    } else {
+        p->len = 1;
+        p->dat[0] = rec->seq_num;
+    }
+}
+
 static bool is_tx_rec_inuse(const seq_tx_rec_t *rec)
 {
     if (rec->wait_head.first || rec->pend_head.first || rec->p0_req)
@@ -105,6 +192,7 @@ static int cdnet_send_pkt(cdnet_intf_t *intf, cdnet_packet_t *pkt)
 
     frame = cd_intf->get_free_frame(cd_intf);
     if (!frame) {
+        intf->tx_no_frame_cnt++;
         dn_warn(intf->name, "tx: no free frame\n");
         return -1;
     }
@@ -122,7 +210,10 @@ static int cdnet_send_pkt(cdnet_intf_t *intf, cdnet_packet_t *pkt)
     }
 
     if (ret_val == 0) {
-        cd_intf->put_tx_frame(cd_intf, frame);
+        if (pkt->urgent && cd_intf->put_tx_frame_urgent)
+            cd_intf->put_tx_frame_urgent(cd_intf, frame);
+        else
+            cd_intf->put_tx_frame(cd_intf, frame);
         return 0;
     } else {
         cd_intf->put_free_frame(cd_intf, frame);
@@ -148,42 +239,63 @@ static void cdnet_p0_service(cdnet_intf_t *intf, cdnet_packet_t *pkt)
         }
     }
 
-    // in check seq_num
+    // in check seq_num, the epoch is only for the senders asked for it
     if (pkt->len == 0) {
-        pkt->len = 1;
-        pkt->dat[0] = rec ? rec->seq_num : 0x80;
+        if (rec && rec->seq_ext) {
+            pkt->len = 2;
+            pkt->dat[0] = rec->seq_num & 0xff;
+            pkt->dat[1] = rec->seq_num >> 8;
+        } else {
+            pkt->len = 1;
+            pkt->dat[0] = rec ? rec->seq_num : 0x80;
+        }
+        if (rec && rec->epoch_ret)
+            pkt->dat[pkt->len++] = intf->epoch;
         cdnet_exchg_src_dst(intf, pkt);
         list_put(&intf->seq_tx_direct_head, &pkt->node);
         return;
     }
 
-    // in set seq_num
-    if (pkt->len == 2 && pkt->dat[0] == 0x00) {
+    // in set seq_num, 0x00: legacy, no epoch return
+    if ((pkt->len == 2 && (pkt->dat[0] == 0x00 || pkt->dat[0] == 0x02))
+#ifdef CDNET_USE_SEQ_EXT
+            || (pkt->len == 3 && pkt->dat[0] == 0x01)
+#endif
+            ) {
+        bool ext = pkt->dat[0] == 0x01;
+        bool epoch_ret = pkt->dat[0] != 0x00;
+        uint16_t seq_num = pkt->dat[1];
+        if (ext)
+            seq_num = (seq_num | pkt->dat[2] << 8) & 0x7fff;
+
         if (rec) {
-            rec->seq_num = pkt->dat[1];
+            rec->seq_num = seq_num;
+            rec->seq_ext = ext;
+            rec->epoch_ret = epoch_ret;
             dn_debug(intf->name, "p0_rx: set seq rec: %d\n", rec->seq_num);
             list_move_begin(&intf->seq_rx_head, pre, cur);
         } else {
-            seq_rx_rec_t *r;
-            r = list_entry(list_get_last(&intf->seq_rx_head), seq_rx_rec_t);
-            if (pkt->multi == CDNET_MULTI_NET) {
-                r->addr = pkt->src_addr;
-            } else {
-                r->addr.mac = pkt->src_mac;
-                r->addr.net = 255;
-            }
-            r->seq_num = pkt->dat[1];
+            seq_rx_rec_t *r = rx_rec_pick(intf, pkt);
+            r->seq_num = seq_num;
+            r->seq_ext = ext;
+            r->epoch_ret = epoch_ret;
             dn_debug(intf->name, "p0_rx: pick seq rec: %d\n", r->seq_num);
-            list_put_begin(&intf->seq_rx_head, &r->node);
+        }
+        // restart of an unreliable stream, no return
+        if (pkt->seq_stream & SEQ_STREAM_UNREL) {
+            cdnet_packet_free(intf, pkt);
+            return;
         }
         pkt->len = 0;
+        if (epoch_ret)
+            pkt->dat[pkt->len++] = intf->epoch;
         cdnet_exchg_src_dst(intf, pkt);
         list_put(&intf->seq_tx_direct_head, &pkt->node);
         return;
     }
 
     dn_warn(intf->name, "p0_rx: unknown pkt\n");
-    cdnet_list_put(intf->free_head, &pkt->node);
+    cdnet_packet_free(intf, pkt);
 }
 
 
@@ -192,8 +304,12 @@ void cdnet_p0_request_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt)
     list_node_t *pre, *cur;
     seq_tx_rec_t *rec = NULL;
 
-    // in ack
-    if (pkt->len == 1) {
+    // in ack, the 2 bytes ack has bit 7 of the last byte set
+    if (pkt->len == 1 || (pkt->len == 2 && (pkt->dat[1] & 0x80))) {
+        uint16_t seq_num = pkt->dat[0];
+        if (pkt->len == 2)
+            seq_num |= (pkt->dat[1] & 0x7f) << 8;
+
         list_for_each(&intf->seq_tx_head, pre, cur) {
             seq_tx_rec_t *r = list_entry(cur, seq_tx_rec_t);
             if (is_tx_rec_match_input(r, pkt)) {
@@ -207,19 +323,51 @@ void cdnet_p0_request_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt)
                 dn_error(intf->name, "p0_rx: no rec found for ack\n");
             else
                 dn_error(intf->name, "p0_rx: late ack, %p\n", rec->p0_req);
-            cdnet_list_put(intf->free_head, &pkt->node);
+            cdnet_packet_free(intf, pkt);
             return;
         }
 
         list_for_each(&rec->pend_head, pre, cur) {
             cdnet_packet_t *p = list_entry(cur, cdnet_packet_t);
-            if (p->_seq_num == pkt->dat[0])
+            if (p->_seq_num == seq_num)
                 break;
             list_get(&rec->pend_head);
-            cdnet_list_put(intf->free_head, cur);
+            seq_tx_finish(intf, cur, CDNET_TX_DELIVERED);
             cur = pre;
         }
-        cdnet_list_put(intf->free_head, &pkt->node);
+        cdnet_packet_free(intf, pkt);
+        return;
+    }
+
+    // in no record report, e.g. the peer reboot
+    if (pkt->len == 3 && pkt->dat[0] == 0x80 && pkt->dat[1] == 0x00) {
+        list_for_each(&intf->seq_tx_head, pre, cur) {
+            seq_tx_rec_t *r = list_entry(cur, seq_tx_rec_t);
+            if (is_tx_rec_match_input(r, pkt)) {
+                rec = r;
+                break;
+            }
+        }
+
+        // ignore the reports during restart, and the late ones after restart
+        // with the epoch of the set_seq return, a lost rec of the same epoch
+        // (e.g. dropped by the peer) is recovered by check_seq
+        if (rec && !rec->p0_req && !(rec->seq_num & SEQ_NUM_INVALID) &&
+                !(rec->peer_epoch_valid && rec->peer_epoch == pkt->dat[2])) {
+            dn_warn(intf->name, "p0_rx: peer lost rec, epoch: %d, restart\n",
+                    pkt->dat[2]);
+            rec->seq_num = SEQ_NUM_INVALID; // set_seq at next cdnet_tx
+            while (rec->pend_head.len)
+                list_put_begin(&rec->wait_head, list_get_last(&rec->pend_head));
+
+            // the unreliable streams of the peer restart from any seq_num
+            list_for_each(&intf->seq_rx_head, pre, cur) {
+                seq_rx_rec_t *r = list_entry(cur, seq_rx_rec_t);
+                if ((r->stream & SEQ_STREAM_UNREL) && is_rx_rec_peer(r, pkt))
+                    r->seq_num = SEQ_NUM_INVALID;
+            }
+        }
+        cdnet_packet_free(intf, pkt);
         return;
     }
 
@@ -240,8 +388,8 @@ void cdnet_p0_reply_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt)
     }
 
     if (!rec || !rec->p0_req ||
-            (rec->p0_req->len == 0 && pkt->len != 1) ||
-            (rec->p0_req->len == 2 && pkt->len != 0)) {
+            (rec->p0_req->len == 0 && (pkt->len == 0 || pkt->len > 3)) ||
+            (rec->p0_req->len >= 2 && pkt->len > 1)) {
         if (!rec)
             dn_error(intf->name, "p0_rx: no rec found for ans\n");
         else if (!rec->p0_req)
@@ -249,24 +397,34 @@ void cdnet_p0_reply_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt)
         else
             dn_error(intf->name, "p0_rx: get wrong ans: (%d, %d)\n",
                     rec->p0_req->len, pkt->len);
-        cdnet_list_put(intf->free_head, &pkt->node);
+        cdnet_packet_free(intf, pkt);
         return;
     }
 
-    if (rec->p0_req->len == 0) { // check return
-        rec->seq_num = pkt->dat[0];
-        if (!(rec->seq_num & 0x80)) {
+    if (rec->p0_req->len == 0) { // check return, [0x80] for no record
+        bool has_epoch = pkt->len == (rec->seq_ext ? 3 : 2);
+        if (has_epoch && rec->peer_epoch_valid &&
+                rec->peer_epoch != pkt->dat[pkt->len - 1])
+            rec->seq_num = SEQ_NUM_INVALID; // peer restarted
+        else if (pkt->len >= 2 && rec->seq_ext)
+            rec->seq_num = pkt->dat[0] | pkt->dat[1] << 8;
+        else if (pkt->len <= 2 && !rec->seq_ext && !(pkt->dat[0] & 0x80))
+            rec->seq_num = pkt->dat[0];
+        else
+            rec->seq_num = SEQ_NUM_INVALID;
+
+        if (!(rec->seq_num & SEQ_NUM_INVALID)) {
             // free, as same as the get ack
             list_for_each(&rec->pend_head, pre, cur) {
                 cdnet_packet_t *p = list_entry(cur, cdnet_packet_t);
                 if (p->_seq_num == rec->seq_num)
                     break;
                 list_get(&rec->pend_head);
-                cdnet_list_put(intf->free_head, cur);
+                seq_tx_finish(intf, cur, CDNET_TX_DELIVERED);
                 cur = pre;
             }
         } else {
-            dn_warn(intf->name, "p0_rx: chk_seq ret: set seq_num to 0x8_\n");
+            dn_warn(intf->name, "p0_rx: chk_seq ret: seq_num invalid\n");
         }
         // re-send left
         if (rec->pend_head.first) {
@@ -274,19 +432,21 @@ void cdnet_p0_reply_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt)
             while (rec->pend_head.len)
                 list_put_begin(&rec->wait_head, list_get_last(&rec->pend_head));
         }
-    } else if (pkt->len == 0) { // set return
+    } else { // set return, empty from the legacy peers
+        rec->peer_epoch = pkt->dat[0];
+        rec->peer_epoch_valid = pkt->len == 1;
         if (rec->pend_head.first) {
             dn_error(intf->name, "p0_rx: set_seq ret: pend_head not empty\n");
             list_for_each(&rec->pend_head, pre, cur) {
                 list_get(&rec->pend_head);
-                cdnet_list_put(intf->free_head, cur);
+                seq_tx_finish(intf, cur, CDNET_TX_FAILED);
                 cur = pre;
             }
         }
     }
 
-    cdnet_list_put(intf->free_head, &rec->p0_req->node);
-    cdnet_list_put(intf->free_head, &pkt->node);
+    cdnet_packet_free(intf, rec->p0_req);
+    cdnet_packet_free(intf, pkt);
     rec->p0_req = NULL;
     rec->p0_retry_cnt = 0;
 }
@@ -304,27 +464,72 @@ void cdnet_seq_rx_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt)
         }
     }
 
-    if (!rec || rec->seq_num != pkt->_seq_num) {
+    if (pkt->seq_stream & SEQ_STREAM_UNREL) {
+        uint16_t diff;
+        if (!rec) {
+            rec = rx_rec_pick(intf, pkt);
+            rec->seq_num = SEQ_NUM_INVALID;
+        } else {
+            list_move_begin(&intf->seq_rx_head, pre, cur);
+        }
+        if (rec->seq_num & SEQ_NUM_INVALID) {
+            rec->seq_num = pkt->_seq_num;
+            dn_debug(intf->name, "seq_rx: start unrel rec: %d\n", rec->seq_num);
+        }
+        rec->seq_ext = pkt->_seq_ext;
+
+        diff = (pkt->_seq_num - rec->seq_num) & (pkt->_seq_ext ? 0x7fff : 0x7f);
+        if (diff > (pkt->_seq_ext ? 0x3fff : 0x3f)) {
+            dn_verbose(intf->name, "seq_rx: drop late, r: %d, i: %d\n",
+                    rec->seq_num, pkt->_seq_num);
+            rec->late_cnt++;
+            cdnet_packet_free(intf, pkt);
+            return;
+        }
+        rec->lost_cnt += diff;
+        rec->seq_num = seq_num_next(pkt->_seq_num, pkt->_seq_ext);
+        cdnet_list_put(&intf->rx_head, &pkt->node);
+        return;
+    }
+
+    if (!rec) {
+        // report to the sender to restart the session at once,
+        // reuse the pkt: [0x80, 0x00, epoch]
+        dn_error(intf->name, "seq_rx: no rec, i: %d\n", pkt->_seq_num);
+        cdnet_exchg_src_dst(intf, pkt);
+        pkt->level = CDNET_L1;
+        pkt->seq = false;
+        pkt->src_port = CDNET_DEF_PORT + pkt->seq_stream;
+        pkt->dst_port = 0;
+        pkt->len = 3;
+        pkt->dat[0] = 0x80;
+        pkt->dat[1] = 0x00;
+        pkt->dat[2] = intf->epoch;
+        list_put(&intf->seq_tx_direct_head, &pkt->node);
+    } else if (rec->seq_num != pkt->_seq_num ||
+            rec->seq_ext != pkt->_seq_ext) {
         dn_error(intf->name, "seq_rx: wrong seq, r: %d, i: %d\n",
-                rec ? rec->seq_num : -1, pkt->_seq_num);
-        cdnet_list_put(intf->free_head, &pkt->node);
+                rec->seq_num, pkt->_seq_num);
+        cdnet_packet_free(intf, pkt);
     } else {
-        rec->seq_num = (rec->seq_num + 1) & 0x7f;
+        rec->seq_num = seq_num_next(rec->seq_num, rec->seq_ext);
         if (pkt->_req_ack) {
-            cdnet_packet_t *p = cdnet_packet_get(intf->free_head);
+            cdnet_packet_t *p = cdnet_ctrl_alloc(intf, 2);
             if (p) {
+                uint8_t dat_size = p->_dat_size;
                 memcpy(p, pkt, offsetof(cdnet_packet_t, src_port));
+                p->_dat_size = dat_size;
                 cdnet_exchg_src_dst(intf, p);
                 p->seq = false;
                 p->level = CDNET_L1;
                 p->seq = false;
-                p->src_port = CDNET_DEF_PORT;
+                p->src_port = CDNET_DEF_PORT + rec->stream;
                 p->dst_port = 0;
-                p->len = 1;
-                p->dat[0] = rec->seq_num;
+                seq_ack_fill(rec, p);
                 list_put(&intf->seq_tx_direct_head, &p->node);
                 dn_verbose(intf->name, "seq_rx: ret ack: %d\n", rec->seq_num);
             } else {
+                intf->ack_no_pkt_cnt++;
                 dn_error(intf->name, "seq_rx: ret ack: no free pkt\n");
             }
         }
@@ -333,6 +538,34 @@ void cdnet_seq_rx_handle(cdnet_intf_t *intf, cdnet_packet_t *pkt)
     }
 }
 
+// notify the receiver to restart from seq_num 0, e.g. after reboot,
+// no return and no retry, it is sent before the data packets
+static void seq_unrel_start(cdnet_intf_t *intf, seq_tx_rec_t *rec)
+{
+    cdnet_packet_t *p = cdnet_ctrl_alloc(intf, 2);
+    if (!p) {
+        intf->p0_no_pkt_cnt++;
+        dn_warn(intf->name, "tx: unrel set_seq: no free pkt\n");
+        return;
+    }
+    p->level = CDNET_L1;
+    p->seq = false;
+    if (rec->addr.net == 255) {
+        p->multi = CDNET_MULTI_NONE;
+    } else {
+        p->multi = CDNET_MULTI_NET;
+        p->dst_addr = rec->addr;
+    }
+    p->dst_mac = rec->addr.mac;
+    cdnet_fill_src_addr(intf, p);
+    p->src_port = CDNET_DEF_PORT + rec->stream;
+    p->dst_port = 0;
+    p->len = 2;
+    p->dat[0] = 0x00;
+    p->dat[1] = 0x00;
+    list_put(&intf->seq_tx_direct_head, &p->node);
+}
+
 void cdnet_seq_tx_routine(cdnet_intf_t *intf)
 {
     list_node_t     *pre, *cur;
@@ -353,9 +586,31 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
             pkt->frag = CDNET_FRAG_NONE;
             pkt->l2_flag = 0;
         }
+        if (!pkt->seq_stream_set)
+            pkt->seq_stream = intf->seq_stream ? intf->seq_stream(pkt) : 0;
+        if (pkt->seq && !is_seq_stream_valid(pkt->seq_stream)) {
+            dn_error(intf->name, "tx: invalid stream %d\n", pkt->seq_stream);
+            seq_tx_finish(intf, &pkt->node, CDNET_TX_EXPIRED);
+            continue;
+        }
+        if (pkt->seq && cdnet_packet_shared(pkt)) {
+            // seq tx writes the header and keeps it in the rec lists
+            dn_error(intf->name, "tx: seq for shared packet\n");
+            seq_tx_finish(intf, &pkt->node, CDNET_TX_EXPIRED);
+            continue;
+        }
         if (pkt->seq && pkt->dst_mac == 255) {
-            pkt->seq = false;
-            dn_warn(intf->name, "tx: not support seq for broadcast yet\n");
+            dn_error(intf->name, "tx: not support seq for broadcast yet\n");
+            seq_tx_finish(intf, &pkt->node, CDNET_TX_EXPIRED);
+            continue;
+        }
+        if (pkt->urgent) {
+            if (!pkt->seq) {
+                // not wait for the seq packets of the same peer
+                list_put(&intf->seq_tx_direct_head, &pkt->node);
+                continue;
+            }
+            pkt->urgent = false; // keep the seq order
         }
 
         list_for_each(&intf->seq_tx_head, pre, cur) {
@@ -393,8 +648,15 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
                 rec->addr.mac = pkt->dst_mac;
                 rec->addr.net = 255;
             }
-            rec->seq_num = 0x80;
-            dn_debug(intf->name, "tx: pick seq rec\n");
+            rec->stream = pkt->seq_stream;
+            // the unreliable stream starts without waiting for set_seq
+            if (rec->stream & SEQ_STREAM_UNREL) {
+                rec->seq_num = 0;
+                seq_unrel_start(intf, rec);
+            } else {
+                rec->seq_num = SEQ_NUM_INVALID;
+            }
+            dn_debug(intf->name, "tx: pick seq rec: %d\n", rec->stream);
         }
         list_put(&rec->wait_head, &pkt->node);
     }
@@ -405,7 +667,7 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
         if (cdnet_send_pkt(intf, pkt) < 0)
             return;
         list_get(&intf->seq_tx_direct_head);
-        cdnet_list_put(intf->free_head, cur);
+        cdnet_packet_free(intf, pkt);
         cur = pre;
     }
 
@@ -423,15 +685,32 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
                 if (r->p0_retry_cnt >= SEQ_TX_RETRY_MAX) {
                     dn_error(intf->name, "tx: reach retry_max\n");
                     while (r->pend_head.first)
-                        cdnet_list_put(intf->free_head, list_get(&r->pend_head));
+                        seq_tx_finish(intf, list_get(&r->pend_head),
+                                CDNET_TX_FAILED);
                     while (r->wait_head.first)
-                        cdnet_list_put(intf->free_head, list_get(&r->wait_head));
-                    cdnet_list_put(intf->free_head, &r->p0_req->node);
+                        seq_tx_finish(intf, list_get(&r->wait_head),
+                                CDNET_TX_EXPIRED);
+                    cdnet_packet_free(intf, r->p0_req);
                     r->p0_req = NULL;
                     r->p0_retry_cnt = 0;
-                    r->seq_num = 0x80;
+                    r->seq_num = SEQ_NUM_INVALID;
                     continue;
                 }
+#ifdef CDNET_USE_SEQ_EXT
+                if (r->p0_req->len == 3 && !tx_rec_sibling(intf, r)) {
+                    // peer may not support 15 bits seq_num, fall back
+                    dn_debug(intf->name, "tx: set_seq: fall back to 7 bits\n");
+                    r->seq_ext = false;
+                    r->p0_req->len = 2;
+                    r->p0_req->dat[0] = 0x02;
+                    r->p0_req->dat[1] = 0x00;
+                } else
+#endif
+                if (r->p0_req->len == 2 && r->p0_req->dat[0] == 0x02) {
+                    // legacy peer ignores the set with epoch return
+                    dn_debug(intf->name, "tx: set_seq: fall back to legacy\n");
+                    r->p0_req->dat[0] = 0x00;
+                }
                 if (cdnet_send_pkt(intf, r->p0_req) == 0) {
                     r->p0_req->_send_time = get_systick();
                     r->p0_retry_cnt++;
@@ -440,9 +719,11 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
             continue;
         }
 
-        if ((r->pend_head.first || r->wait_head.first) && (r->seq_num & 0x80)) {
-            r->p0_req = cdnet_packet_get(intf->free_head);
+        if ((r->pend_head.first || r->wait_head.first) &&
+                (r->seq_num & SEQ_NUM_INVALID)) {
+            r->p0_req = cdnet_ctrl_alloc(intf, 4);
             if (!r->p0_req) {
+                intf->p0_no_pkt_cnt++;
                 dn_error(intf->name, "tx: set_seq: no free pkt\n");
                 continue;
             }
@@ -458,11 +739,25 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
             }
             r->p0_req->dst_mac = r->addr.mac;
             cdnet_fill_src_addr(intf, r->p0_req);
-            r->p0_req->src_port = CDNET_DEF_PORT;
+            r->p0_req->src_port = CDNET_DEF_PORT + r->stream;
             r->p0_req->dst_port = 0;
-            r->p0_req->len = 2;
-            r->p0_req->dat[0] = 0x00;
-            r->p0_req->dat[1] = 0x00;
+#ifdef CDNET_USE_SEQ_EXT
+            // follow the seq_num width of other streams of the same peer
+            seq_tx_rec_t *sibling = tx_rec_sibling(intf, r);
+            r->seq_ext = sibling ? sibling->seq_ext : true;
+#else
+            r->seq_ext = false;
+#endif
+            if (r->seq_ext) {
+                r->p0_req->len = 3;
+                r->p0_req->dat[0] = 0x01;
+                r->p0_req->dat[1] = 0x00;
+                r->p0_req->dat[2] = 0x00;
+            } else {
+                r->p0_req->len = 2;
+                r->p0_req->dat[0] = 0x02;
+                r->p0_req->dat[1] = 0x00;
+            }
             if (cdnet_send_pkt(intf, r->p0_req) == 0)
                 r->p0_req->_send_time = get_systick();
             else
@@ -477,8 +772,9 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
             if (get_systick() - pkt->_send_time > SEQ_TIMEOUT) {
                 dn_verbose(intf->name, "tx: pending timeout\n");
                 // send check
-                r->p0_req = cdnet_packet_get(intf->free_head);
+                r->p0_req = cdnet_ctrl_alloc(intf, 4);
                 if (!r->p0_req) {
+                    intf->p0_no_pkt_cnt++;
                     dn_error(intf->name, "tx: chk_seq: no free pkt\n");
                     continue;
                 }
@@ -493,7 +789,7 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
                 }
                 r->p0_req->dst_mac = r->addr.mac;
                 cdnet_fill_src_addr(intf, r->p0_req);
-                r->p0_req->src_port = CDNET_DEF_PORT;
+                r->p0_req->src_port = CDNET_DEF_PORT + r->stream;
                 r->p0_req->dst_port = 0;
                 r->p0_req->len = 0;
                 r->send_cnt = 0;
@@ -506,16 +802,28 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
             }
         }
 
+#ifdef CDNET_USE_SEQ_EXT
+        // follow the seq_num width of the reliable streams
+        if (r->stream & SEQ_STREAM_UNREL) {
+            seq_tx_rec_t *sibling = tx_rec_sibling(intf, r);
+            r->seq_ext = sibling ? sibling->seq_ext : false;
+        }
+#endif
+
         // send wait_head
         list_for_each(&r->wait_head, p, c) {
             int ret;
             cdnet_packet_t *pkt = list_entry(c, cdnet_packet_t);
 
-            if (r->pend_head.len > SEQ_TX_PEND_MAX)
+            if (r->pend_head.len >
+                    (r->seq_ext ? SEQ_TX_PEND_MAX_EXT : SEQ_TX_PEND_MAX))
                 break;
             if (pkt->seq) {
                 pkt->_seq_num = r->seq_num;
-                if (++r->send_cnt == SEQ_TX_ACK_CNT) {
+                pkt->_seq_ext = r->seq_ext;
+                if (r->stream & SEQ_STREAM_UNREL) {
+                    pkt->_req_ack = false;
+                } else if (++r->send_cnt == SEQ_TX_ACK_CNT) {
                     r->send_cnt = 0;
                     pkt->_req_ack = true;
                 } else {
@@ -526,14 +834,16 @@ void cdnet_seq_tx_routine(cdnet_intf_t *intf)
             if (ret < 0)
                 return;
             list_get(&r->wait_head);
-            if (ret == 0 && pkt->seq) {
-                r->seq_num = (r->seq_num + 1) & 0x7f;
+            if (ret == 0 && pkt->seq)
+                r->seq_num = seq_num_next(r->seq_num, r->seq_ext);
+            if (ret == 0 && pkt->seq && !(r->stream & SEQ_STREAM_UNREL)) {
                 pkt->_send_time = get_systick();
                 list_put(&r->pend_head, c);
+            } else if (ret != 0) {
+                dn_error(intf->name, "tx: send wait_head error\n");
+                seq_tx_finish(intf, c, CDNET_TX_EXPIRED);
             } else {
-                if (ret != 0)
-                    dn_error(intf->name, "tx: send wait_head error\n");
-                cdnet_list_put(intf->free_head, c);
+                cdnet_packet_free(intf, pkt); // unreliable, not reported
             }
             c = p;
         }
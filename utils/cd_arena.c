@@ -0,0 +1,53 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#include "cd_utils.h"
+#include "cd_list.h"
+#include "cd_arena.h"
+
+
+void cd_arena_init(cd_arena_t *a, void *buf, uint32_t size)
+{
+    a->buf = buf;
+    a->size = size;
+    a->used = 0;
+    a->need = 0;
+}
+
+// zeroed memory, align: power of 2, e.g. CD_CACHE_LINE for hot structures,
+// return NULL if no space, and for all later calls to keep a->need exact
+void *cd_arena_alloc(cd_arena_t *a, uint32_t size, uint32_t align)
+{
+    uintptr_t addr = (uintptr_t)a->buf + a->need;
+    uint32_t pad = ((addr + align - 1) & ~(uintptr_t)(align - 1)) - addr;
+    bool failed = a->need != a->used;
+
+    a->need += pad + size;
+    if (failed || a->need > a->size)
+        return NULL;
+    a->used = a->need;
+    memset(a->buf + a->used - size, 0, size);
+    return a->buf + a->used - size;
+}
+
+// num nodes in one cache line aligned block, put to head,
+// node_size is rounded up to the pointer alignment, return -1 if no space
+int cd_arena_list_fill(cd_arena_t *a, list_head_t *head,
+        uint32_t node_size, int num)
+{
+    uint8_t *mem;
+
+    node_size = (node_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    mem = cd_arena_alloc(a, node_size * num, CD_CACHE_LINE);
+    if (!mem)
+        return -1;
+    for (int i = 0; i < num; i++)
+        list_put(head, (list_node_t *)(mem + i * node_size));
+    return 0;
+}
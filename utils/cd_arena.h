@@ -0,0 +1,33 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#ifndef __CD_ARENA_H__
+#define __CD_ARENA_H__
+
+// carve long lived structures from one memory block at init time,
+// nothing is freed back
+
+#ifndef CD_CACHE_LINE
+#define CD_CACHE_LINE       32
+#endif
+
+typedef struct {
+    uint8_t     *buf;
+    uint32_t    size;
+    uint32_t    used;   // footprint, including the alignment gaps
+    uint32_t    need;   // used + failed requests, the size to make all fit
+} cd_arena_t;
+
+
+void cd_arena_init(cd_arena_t *a, void *buf, uint32_t size);
+void *cd_arena_alloc(cd_arena_t *a, uint32_t size, uint32_t align);
+int cd_arena_list_fill(cd_arena_t *a, list_head_t *head,
+        uint32_t node_size, int num);
+
+#endif
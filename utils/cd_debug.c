@@ -18,7 +18,7 @@ extern uart_t debug_uart;
     #define DBG_STR_LEN 80
 #endif
 #ifndef DBG_LEN
-    #define DBG_LEN     60
+    #define DBG_LEN     60 // 0 for debug_init_mem only
 #endif
 
 typedef struct {
@@ -28,7 +28,9 @@ typedef struct {
 } dbg_node_t;
 
 
+#if DBG_LEN
 static dbg_node_t dbg_alloc[DBG_LEN];
+#endif
 
 static list_head_t dbg_free = {0};
 static list_head_t dbg_tx = {0};
@@ -84,9 +86,22 @@ void dhtoa(uint32_t val, char *buf)
 
 void debug_init(void)
 {
+#if DBG_LEN
     int i;
     for (i = 0; i < DBG_LEN; i++)
         list_put(&dbg_free, &dbg_alloc[i].node);
+#endif
+}
+
+// add nodes from other memory, e.g. from cd_arena_alloc,
+// return the number of nodes
+int debug_init_mem(void *mem, int size)
+{
+    int i;
+    int num = size / sizeof(dbg_node_t);
+    for (i = 0; i < num; i++)
+        list_put(&dbg_free, &((dbg_node_t *)mem)[i].node);
+    return num;
 }
 
 void debug_flush(void)
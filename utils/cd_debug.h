@@ -68,6 +68,7 @@ void _dprintf(char *format, ...);
 void _dputs(char *str);
 void dhtoa(uint32_t val, char *buf);
 void debug_init(void);
+int debug_init_mem(void *mem, int size);
 void debug_flush(void);
 
 void hex_dump_small(char *pbuf, const void *addr, int len, int max);
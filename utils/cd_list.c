@@ -91,6 +91,8 @@ void list_pick(list_head_t *head, list_node_t *pre, list_node_t *node)
         head->first = node->next;
     if (--head->len == 0)
         head->last = NULL;
+    else if (head->last == node)
+        head->last = pre;
 #ifdef LIST_DEBUG
     list_check(head);
 #endif
@@ -0,0 +1,98 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#include "cd_utils.h"
+#include "cd_mag.h"
+
+
+void cd_mag_init(cd_mag_t *m, list_head_t *shared, uint8_t batch, uint8_t cap)
+{
+    m->shared = shared;
+    list_head_init(&m->local);
+    m->batch = max(batch, 1);
+    m->max = max(cap, m->batch);
+}
+
+list_node_t *cd_mag_get(cd_mag_t *m)
+{
+    if (!m->local.len) {
+        uint32_t flags;
+        list_node_t *first, *last;
+        uint32_t n;
+
+        // take the first n nodes of shared as one chain
+        local_irq_save(flags);
+        n = min(m->batch, m->shared->len);
+        first = last = m->shared->first;
+        for (uint32_t i = 1; i < n; i++)
+            last = last->next;
+        if (n) {
+            m->shared->first = last->next;
+            m->shared->len -= n;
+            if (!m->shared->len)
+                m->shared->last = NULL;
+        }
+        local_irq_restore(flags);
+
+        if (!n)
+            return NULL;
+        last->next = NULL;
+        m->local.first = first;
+        m->local.last = last;
+        m->local.len = n;
+    }
+    return list_get(&m->local);
+}
+
+// append the chain [first, last] of n nodes to shared
+static void mag_return(cd_mag_t *m, list_node_t *first,
+        list_node_t *last, uint32_t n)
+{
+    uint32_t flags;
+    last->next = NULL;
+    local_irq_save(flags);
+    if (m->shared->len)
+        m->shared->last->next = first;
+    else
+        m->shared->first = first;
+    m->shared->last = last;
+    m->shared->len += n;
+    local_irq_restore(flags);
+}
+
+// return all cached nodes to shared
+void cd_mag_flush(cd_mag_t *m)
+{
+    if (m->local.len)
+        mag_return(m, m->local.first, m->local.last, m->local.len);
+    list_head_init(&m->local);
+}
+
+void cd_mag_put(cd_mag_t *m, list_node_t *node)
+{
+    list_node_t *pre;
+
+    // the last freed is the next to get, still in the cpu cache
+    list_put_begin(&m->local, node);
+    if (m->local.len < m->max)
+        return;
+
+    if (m->local.len == m->batch) {
+        cd_mag_flush(m);
+        return;
+    }
+    // return the oldest batch at the tail
+    pre = m->local.first;
+    for (uint32_t i = 1; i < m->local.len - m->batch; i++)
+        pre = pre->next;
+    mag_return(m, pre->next, m->local.last, m->batch);
+    pre->next = NULL;
+    m->local.last = pre;
+    m->local.len -= m->batch;
+}
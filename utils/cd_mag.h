@@ -0,0 +1,50 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#ifndef __CD_MAG_H__
+#define __CD_MAG_H__
+
+#include "cd_list.h"
+
+// per-context cache (magazine) of a shared free list, e.g. one for the main
+// loop while the isr keeps using the shared list by list_*_it,
+// the shared list is only locked for the batch refill and return,
+// nodes cached by one context are not visible to the others
+typedef struct {
+    list_head_t     *shared;
+    list_head_t     local;
+    uint8_t         batch;  // nodes per refill and return
+    uint8_t         max;    // return a batch when local reaches it
+} cd_mag_t;
+
+
+void cd_mag_init(cd_mag_t *m, list_head_t *shared, uint8_t batch, uint8_t cap);
+list_node_t *cd_mag_get(cd_mag_t *m);
+void cd_mag_put(cd_mag_t *m, list_node_t *node);
+void cd_mag_flush(cd_mag_t *m);
+
+#define cd_mag_get_entry(m, type)   list_entry_safe(cd_mag_get(m), type)
+
+// for a shared list also taken by an isr, which can't see the cache:
+// return all cached nodes once shared has less than keep
+static inline void cd_mag_put_keep(cd_mag_t *m, list_node_t *node,
+        uint32_t keep)
+{
+    cd_mag_put(m, node);
+    if (m->shared->len < keep)
+        cd_mag_flush(m);
+}
+
+// free nodes of this context
+static inline uint32_t cd_mag_len(const cd_mag_t *m)
+{
+    return m->shared->len + m->local.len;
+}
+
+#endif
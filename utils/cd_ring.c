@@ -0,0 +1,102 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#include "cd_utils.h"
+#include "cd_ring.h"
+
+
+void cd_ring_init(cd_ring_t *r, void *buf, uint32_t size)
+{
+    r->buf = buf;
+    r->size = size & ~(CD_RING_ALIGN - 1);
+    r->wr = r->rd = r->fr = 0;
+    r->end = r->size;
+    r->num = r->rd_num = 0;
+}
+
+// reserve max bytes at the write position, return NULL if no space,
+// a following cd_ring_prepare replaces the last one if not committed
+void *cd_ring_prepare(cd_ring_t *r, uint32_t max)
+{
+    uint32_t flags;
+    uint32_t need = CD_RING_HDR + cd_ring_align(max);
+    void *blk = NULL;
+
+    local_irq_save(flags);
+    if (!r->num) {
+        r->wr = r->rd = r->fr = 0;
+        r->end = r->size;
+    }
+
+    if (r->wr < r->fr || (r->wr == r->fr && r->num)) {
+        // wrapped, the free space is between wr and fr
+        if (r->fr - r->wr >= need)
+            blk = r->buf + r->wr + CD_RING_HDR;
+    } else if (r->size - r->wr >= need) {
+        blk = r->buf + r->wr + CD_RING_HDR;
+    } else if (r->fr >= need) {
+        r->end = r->wr;
+        r->wr = 0;
+        blk = r->buf + CD_RING_HDR;
+    }
+    local_irq_restore(flags);
+    return blk;
+}
+
+// finish the prepared block with the real length
+void cd_ring_commit(cd_ring_t *r, uint32_t len)
+{
+    uint32_t flags;
+    uint32_t size = CD_RING_HDR + cd_ring_align(len);
+
+    local_irq_save(flags);
+    *(uint32_t *)(r->buf + r->wr) = size;
+    r->wr += size;
+    r->num++;
+    r->rd_num++;
+    local_irq_restore(flags);
+}
+
+void *cd_ring_get(cd_ring_t *r)
+{
+    uint32_t flags;
+    void *blk = NULL;
+
+    local_irq_save(flags);
+    if (r->rd_num) {
+        if (r->rd == r->end)
+            r->rd = 0;
+        blk = r->buf + r->rd + CD_RING_HDR;
+        r->rd += *(uint32_t *)(r->buf + r->rd);
+        r->rd_num--;
+    }
+    local_irq_restore(flags);
+    return blk;
+}
+
+// blocks must be freed in the order of cd_ring_get
+void cd_ring_free(cd_ring_t *r, void *blk)
+{
+    uint32_t flags;
+
+    local_irq_save(flags);
+    if (r->num == r->rd_num || blk != r->buf + r->fr + CD_RING_HDR) {
+        local_irq_restore(flags);
+        d_error("cd_ring: free out of order\n");
+        return;
+    }
+    r->fr += *(uint32_t *)(r->buf + r->fr);
+    if (--r->num && r->fr == r->end) {
+        if (r->rd == r->end)
+            r->rd = 0;
+        r->fr = 0;
+        r->end = r->size;
+    }
+    local_irq_restore(flags);
+}
@@ -0,0 +1,44 @@
+/*
+ * Software License Agreement (MIT License)
+ *
+ * Copyright (c) 2017, DUKELEC, Inc.
+ * All rights reserved.
+ *
+ * Author: Duke Fong <duke@dukelec.com>
+ */
+
+#ifndef __CD_RING_H__
+#define __CD_RING_H__
+
+// variable length blocks in one contiguous buffer, freed in fifo order,
+// for one producer (e.g. rx isr) and one consumer
+
+#define CD_RING_ALIGN       sizeof(void *)
+#define CD_RING_HDR         CD_RING_ALIGN // block size, aligned
+#define cd_ring_align(n)    (((n) + CD_RING_ALIGN - 1) & ~(CD_RING_ALIGN - 1))
+
+typedef struct {
+    uint8_t     *buf;   // aligned to CD_RING_ALIGN
+    uint32_t    size;
+    uint32_t    wr;     // next block to write
+    uint32_t    rd;     // next block for cd_ring_get
+    uint32_t    fr;     // oldest block not freed
+    uint32_t    end;    // the writer wrapped to 0 at here
+    uint16_t    num;    // blocks not freed
+    uint16_t    rd_num; // blocks not got
+} cd_ring_t;
+
+
+void cd_ring_init(cd_ring_t *r, void *buf, uint32_t size);
+void *cd_ring_prepare(cd_ring_t *r, uint32_t max);
+void cd_ring_commit(cd_ring_t *r, uint32_t len);
+void *cd_ring_get(cd_ring_t *r);
+void cd_ring_free(cd_ring_t *r, void *blk);
+
+static inline bool cd_ring_has(const cd_ring_t *r, const void *blk)
+{
+    return (const uint8_t *)blk >= r->buf &&
+            (const uint8_t *)blk < r->buf + r->size;
+}
+
+#endif